@@ -24,381 +24,3810 @@ SOFTWARE.
 
 #include "TraceDebug.hpp"
 #ifdef ENABLE_TRACE_DEBUG
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <set>
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+#include "TraceDebugBinaryFormat.hpp"
+#endif
+#ifdef TRACE_DEBUG_CHROME_TRACE
+#include <cstdio>
+#include <cstdlib>
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+#include <cstdio>
+#endif
+#if defined(TRACE_DEBUG_TSC_CLOCK) && defined(__GNUC__)
+#include <cpuid.h>
+#endif
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+#include "TraceDebugMappedFormat.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+#endif
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+#include <cstdio>
+#ifdef TRACE_DEBUG_COMPRESS_OUTPUT
+#include <zlib.h>
+#endif
+#endif
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+#include <signal.h>
+#include <unistd.h>
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 // ==============================================================================================================================
 #ifdef ENABLE_THREAD_SAFE
-std::map<std::thread::id, unsigned int>                                 TraceDebug::debugPrintDeepness;
-std::recursive_mutex                                                    TraceDebug::the_mutex;
+thread_local unsigned int                                               TraceDebug::debugPrintDeepness = 0;
 #else
 unsigned int                                                            TraceDebug::debugPrintDeepness = 0;
 #endif
+#ifdef TRACE_DEBUG_USE_GLOBAL_MUTEX
+std::atomic<unsigned int>                                               TraceDebug::allDebugPrintDeepness(0);
+#endif
+#ifdef ENABLE_THREAD_SAFE
+std::recursive_mutex                                                    TraceDebug::the_mutex;
+std::mutex                                                              TraceDebug::callSitesMutex;
+#endif
+#ifdef TRACE_DEBUG_LOCK_FREE
+thread_local std::shared_ptr<TraceDebugThreadBuffer>                    TraceDebug::threadBuffer;
+std::vector<std::shared_ptr<TraceDebugThreadBuffer>>                    TraceDebug::threadBuffers;
+std::mutex                                                              TraceDebug::threadBuffersMutex;
+#endif
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+std::vector<TraceDebugEvent>                                            TraceDebug::pendingOutputs;
+std::thread                                                             TraceDebug::writerThread;
+std::mutex                                                              TraceDebug::writerMutex;
+std::condition_variable                                                 TraceDebug::writerCondition;
+bool                                                                    TraceDebug::writerStopRequested = false;
+std::atomic<unsigned int>                                               TraceDebug::outputFlushIntervalMs(TRACE_DEBUG_FLUSH_INTERVAL_MS);
+#endif
+std::atomic<unsigned long long>                                         TraceDebug::droppedTraces(0);
 #ifdef WRITE_OUTPUT_TO_FILE
 std::ofstream                                                           TraceDebug::outputFile;
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+TraceDebugMappedFile                                                    TraceDebug::mappedFile;
+#endif
 #endif
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+std::string                                                             TraceDebug::outputSegmentBaseName;
+unsigned long long                                                      TraceDebug::outputSegmentNumber = 0;
+unsigned long long                                                      TraceDebug::outputSegmentSize = 0;
+std::chrono::steady_clock::time_point                                   TraceDebug::outputSegmentOpenTime;
+std::vector<std::string>                                                TraceDebug::pendingSegments;
+std::deque<std::string>                                                 TraceDebug::archivedSegments;
+std::thread                                                             TraceDebug::archiveThread;
+std::mutex                                                              TraceDebug::archiveMutex;
+std::condition_variable                                                 TraceDebug::archiveCondition;
+bool                                                                    TraceDebug::archiveStopRequested = false;
+#endif
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+std::vector<bool>                                                       TraceDebug::binaryCallSitesWritten;
+std::map<std::thread::id, unsigned int>                                 TraceDebug::binaryThreadIndexes;
+std::map<std::string, unsigned int>                                     TraceDebug::binaryLabelIds;
+#endif
+#ifdef TRACE_DEBUG_CHROME_TRACE
+std::map<std::thread::id, unsigned int>                                 TraceDebug::chromeTraceThreadIds;
+unsigned long long                                                      TraceDebug::chromeTraceEventCount = 0;
+#endif
+std::map<std::thread::id, std::string>                                  TraceDebug::threadIdTexts;
 #ifdef USE_QT_DEBUG
 QBuffer                                                                 TraceDebug::qDebugBuffer;
 QDebug *                                                                TraceDebug::qDebugLogger = nullptr;
 #endif
-unsigned int                                                            TraceDebug::traceCacheDeepness = 0;
-bool                                                                    TraceDebug::traceActive = true;
-bool                                                                    TraceDebug::displayStartTracePerformance = true;
-std::vector<std::string>                                                TraceDebug::localCache;
-std::map<std::string, int>                                              TraceDebug::mapFileNameToLine;
-std::map<std::string,
-         std::vector<std::pair<std::string,
-                               std::chrono::steady_clock::time_point>>>
-                                                                        TraceDebug::mapFileNameFunctionNameToVectorTimingInfo;
+std::atomic<unsigned int>                                               TraceDebug::traceCacheDeepness(0);
+std::atomic<bool>                                                       TraceDebug::traceActive(true);
+std::atomic<bool>                                                       TraceDebug::displayStartTracePerformance(true);
+std::vector<TraceDebugEvent>                                            TraceDebug::localCache;
+TRACE_DEBUG_PER_THREAD std::vector<int>                                 TraceDebug::scopeLines;
+#ifdef ENABLE_THREAD_SAFE
+thread_local std::vector<TraceDebugTimings>                             TraceDebug::measureTimings;
+thread_local unsigned int                                               TraceDebug::measureCount = 0;
+#else
+std::vector<TraceDebugTimings>                                          TraceDebug::measureTimings;
+unsigned int                                                            TraceDebug::measureCount = 0;
+#endif
+std::map<std::string, unsigned int>                                     TraceDebug::scopeIds;
+std::vector<const TraceDebugCallSite*>                                  TraceDebug::callSites;
+#ifdef ENABLE_THREAD_SAFE
+thread_local TraceDebugSamplingStates                                   TraceDebug::samplingStates;
+#else
+TraceDebugSamplingStates                                                TraceDebug::samplingStates;
+#endif
+std::vector<std::pair<std::string, const TraceDebugSampling*>>          TraceDebug::samplingRules;
+std::deque<TraceDebugSampling>                                          TraceDebug::samplingPolicies;
+std::vector<std::pair<std::string, bool>>                               TraceDebug::enableRules;
+bool                                                                    TraceDebug::enableRulesLoaded = false;
+std::deque<TraceDebugCounter>                                           TraceDebug::counters;
+#ifdef ENABLE_THREAD_SAFE
+std::mutex                                                              TraceDebug::countersMutex;
+thread_local unsigned int                                               TraceDebugCounter::threadShard = 0;
+#else
+unsigned int                                                            TraceDebugCounter::threadShard = 0;
+#endif
+std::atomic<unsigned int>                                               TraceDebugCounter::nextShard(0);
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+thread_local std::shared_ptr<TraceDebugStatisticsShard>                 TraceDebug::statisticsShard;
+std::vector<std::shared_ptr<TraceDebugStatisticsShard>>                 TraceDebug::statisticsShards;
+TraceDebugStatisticsShard                                               TraceDebug::exitedThreadsStatistics;
+std::mutex                                                              TraceDebug::statisticsShardsMutex;
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+std::ofstream                                                           TraceDebug::timeSeriesFile;
+bool                                                                    TraceDebug::timeSeriesJson = false;
+unsigned int                                                            TraceDebug::timeSeriesIntervalMs = 0;
+TraceDebugClock::Ticks                                                  TraceDebug::timeSeriesWindowStart = 0;
+std::thread                                                             TraceDebug::timeSeriesThread;
+std::mutex                                                              TraceDebug::timeSeriesMutex;
+std::condition_variable                                                 TraceDebug::timeSeriesCondition;
+bool                                                                    TraceDebug::timeSeriesStopRequested = false;
+#endif
+#ifdef TRACE_DEBUG_CALL_TREE
+thread_local std::shared_ptr<TraceDebugCallTree>                        TraceDebug::callTree;
+std::vector<std::shared_ptr<TraceDebugCallTree>>                        TraceDebug::callTrees;
+TraceDebugCallTree                                                      TraceDebug::exitedThreadsCallTree;
+std::mutex                                                              TraceDebug::callTreesMutex;
+#endif
+std::atomic<unsigned long long>                                         TraceDebug::contextCount(0);
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+#ifdef ENABLE_THREAD_SAFE
+thread_local TraceDebugFlightRecorder                                   TraceDebug::flightRecorder;
+#else
+TraceDebugFlightRecorder                                                TraceDebug::flightRecorder;
+#endif
+std::vector<std::pair<std::string, TraceDebugClock::Ticks>>             TraceDebug::slowThresholdRules;
+#endif
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+#ifdef ENABLE_THREAD_SAFE
+thread_local TraceDebugThreadScopes                                     TraceDebug::threadScopes;
+#else
+TraceDebugThreadScopes                                                  TraceDebug::threadScopes;
+#endif
+std::atomic<TraceDebugThreadScopes*>                                    TraceDebug::allThreadScopes[TRACE_DEBUG_SIGNAL_MAX_THREADS];
+int                                                                     TraceDebug::signalFileDescriptor = STDERR_FILENO;
+std::atomic<bool>                                                       TraceDebug::signalReceived(false);
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+TraceDebugOverhead                                                      TraceDebug::overhead;
+#ifdef ENABLE_THREAD_SAFE
+thread_local TraceDebugClock::Ticks                                     TraceDebug::threadOverhead = 0;
+thread_local TraceDebugClock::Ticks*                                    TraceDebug::overheadMeasure = nullptr;
+#else
+TraceDebugClock::Ticks                                                  TraceDebug::threadOverhead = 0;
+TraceDebugClock::Ticks*                                                 TraceDebug::overheadMeasure = nullptr;
+#endif
+#endif
+
+#ifdef TRACE_DEBUG_TSC_CLOCK
+namespace {
+  // Calibrates the clock when the program starts rather than when the first trace is written
+  const long long programStartTime = TraceDebugClock::ToEpochNanoseconds(TraceDebugClock::Now());
+}
+#endif
 
 // ==============================================================================================================================
-std::string TraceDebug::GetUniqueKey(const std::string & string1,
-                                     const std::string & string2,
-                                     const std::string& string3)
-{
-  return string1 + string2 + string3;
+const TraceDebugClock::Calibration& TraceDebugClock::GetCalibration() {
+  static const Calibration calibration = []() {
+    Calibration result;
+    result.startEpochNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    result.startTicks = Now();
+#ifdef TRACE_DEBUG_TSC_CLOCK
+#ifdef __GNUC__
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    // CPUID 0x80000007 EDX bit 8: the counter rate does not depend on the frequency or the sleep state of the processor
+    if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || (edx & (1U << 8)) == 0) {
+      std::cerr << "TraceDebug: the time stamp counter may not be invariant, durations may be wrong with TRACE_DEBUG_USE_TSC"
+                << std::endl;
+    }
+#endif
+    // Both clocks are read in the same order at both ends so that the time between the 2 reads cancels out
+    const auto steadyStart = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_DEBUG_TSC_CALIBRATION_MS));
+    const Ticks endTicks = Now();
+    const auto steadyEnd = std::chrono::steady_clock::now();
+    result.nanosecondsPerTick =
+            static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(steadyEnd - steadyStart).count()) /
+            static_cast<double>(endTicks - result.startTicks);
+#else
+    result.nanosecondsPerTick = 1e9 * std::chrono::steady_clock::period::num / std::chrono::steady_clock::period::den;
+#endif
+    return result;
+  }();
+  return calibration;
+}
+
+// ==============================================================================================================================
+long long TraceDebugClock::ToNanoseconds(Ticks ticks) {
+#ifdef TRACE_DEBUG_TSC_CLOCK
+  return std::llround(static_cast<double>(ticks) * GetCalibration().nanosecondsPerTick);
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::duration(ticks)).count();
+#endif
+}
+
+// ==============================================================================================================================
+TraceDebugClock::Ticks TraceDebugClock::FromNanoseconds(long long nanoseconds) {
+#ifdef TRACE_DEBUG_TSC_CLOCK
+  return std::llround(static_cast<double>(nanoseconds) / GetCalibration().nanosecondsPerTick);
+#else
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(nanoseconds)).count();
+#endif
+}
+
+// ==============================================================================================================================
+long long TraceDebugClock::ToEpochNanoseconds(Ticks ticks) {
+  const Calibration& calibration = GetCalibration();
+  return calibration.startEpochNanoseconds + ToNanoseconds(ticks - calibration.startTicks);
 }
 
 // ==============================================================================================================================
-TraceDebug::TraceDebug(const std::string & functionName, const std::string & fileName,
-                       int lineNumber, const std::string & uniqueKey): debugPerformanceMustBeDisplayed(true) {
-  keyDebugPerformanceToErase = GetUniqueKey(fileName, functionName, uniqueKey);
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+namespace {
+  // Duration between two trace points without the cost of the traces done in between
+  TraceDebugClock::Ticks GetCorrectedDuration(const TraceDebugTiming& from, const TraceDebugTiming& to) {
+    return std::max<TraceDebugClock::Ticks>(0, (to.time - from.time) - (to.overhead - from.overhead));
+  }
+
+  // Smallest mean cost of a trace over several batches: batches interrupted by the system are ignored
+  template <typename Trace>
+  TraceDebugClock::Ticks GetTraceCost(Trace trace) {
+    const int batchCount = 16;
+    const int batchSize = 64;
+    TraceDebugClock::Ticks cost = 0;
+    for(int batch = 0; batch < batchCount; ++batch) {
+      const TraceDebugClock::Ticks start = TraceDebugClock::Now();
+      for(int index = 0; index < batchSize; ++index) {
+        trace();
+      }
+      const TraceDebugClock::Ticks batchCost = (TraceDebugClock::Now() - start) / batchSize;
+      if(batch == 0 || batchCost < cost) cost = batchCost;
+    }
+    return cost;
+  }
+}
+
+void TraceDebug::MeasureOverhead() {
+  TraceDebugClock::Ticks lastMeasure = 0;
+  TraceDebugOverhead measured;
+  {
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+    // The measures are really done but not kept
+    std::shared_ptr<TraceDebugStatisticsShard> scratchShard = std::make_shared<TraceDebugStatisticsShard>();
+    statisticsShard.swap(scratchShard);
+#endif
+    overheadMeasure = &lastMeasure;
+    TraceDebugClock::Ticks scopeInside = 0;
+    measured.scope = GetTraceCost([&]() {
+      {
+        START_TRACE_PERFORMANCE(overheadScope);
+      }
+      if(scopeInside == 0 || lastMeasure < scopeInside) scopeInside = lastMeasure;
+    });
+    measured.scopeInside = scopeInside;
+    const TraceDebugClock::Ticks scopeWithCheckpoint = GetTraceCost([]() {
+      START_TRACE_PERFORMANCE(overheadCheckpoint);
+      ADD_TRACE_PERFORMANCE(overheadCheckpoint, "Checkpoint");
+    });
+    measured.checkpoint = std::max<TraceDebugClock::Ticks>(0, scopeWithCheckpoint - measured.scope);
+    measured.value = GetTraceCost([]() { DISPLAY_DEBUG_VALUE(0); });
+    measured.immediateValue = GetTraceCost([]() { DISPLAY_IMMEDIATE_DEBUG_VALUE(0); });
+    measured.message = GetTraceCost([]() { DISPLAY_DEBUG_MESSAGE(""); });
+    overheadMeasure = nullptr;
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+    statisticsShard.swap(scratchShard);
+#endif
+  }
   GET_THREAD_SAFE_GUARD;
-  IncreaseDebugPrintDeepness();
-  lineHeader = fileName + ":" + std::to_string(lineNumber) + " (" + functionName + ") [" + uniqueKey + "]";
+  overhead = measured;
+}
+
+// ==============================================================================================================================
+const TraceDebugOverhead& TraceDebug::GetOverhead() {
+  return overhead;
+}
+#endif
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+namespace {
+  struct PerfEvent {
+    unsigned int type;
+    unsigned long long config;
+    const char* name;
+  };
+
+  const PerfEvent hardwareEvents[TraceDebugCounters::count] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+  };
+
+  const PerfEvent softwareEvents[TraceDebugCounters::count] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ns"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations"},
+  };
+
+  // Events opened by all threads, chosen by the first thread opening its counters: null until then or if none could be
+  std::atomic<const PerfEvent*> perfEvents(nullptr);
+  std::atomic<bool> perfEventsChosen(false);
+
+  // Counters of one thread, all in the same group so that they are read together
+  struct ThreadPerfCounters {
+    bool opened = false;
+    int fileDescriptors[TraceDebugCounters::count] = {-1, -1, -1, -1};
+    // Mapped when the counter can be read with rdpmc
+    perf_event_mmap_page* pages[TraceDebugCounters::count] = {};
+
+    bool Open(const PerfEvent* events) {
+      for(unsigned int index = 0; index < TraceDebugCounters::count; ++index) {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = events[index].type;
+        attributes.config = events[index].config;
+        attributes.read_format = PERF_FORMAT_GROUP;
+        // Allowed without privileges when perf_event_paranoid is 2
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        fileDescriptors[index] = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1,
+                                                          index == 0 ? -1 : fileDescriptors[0], 0));
+        if(fileDescriptors[index] < 0) {
+          Close();
+          return false;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        if(events[index].type == PERF_TYPE_HARDWARE) {
+          void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fileDescriptors[index], 0);
+          pages[index] = page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page);
+        }
+#endif
+      }
+      return true;
+    }
+
+    void Close() {
+      for(unsigned int index = 0; index < TraceDebugCounters::count; ++index) {
+        if(pages[index] != nullptr) {
+          munmap(pages[index], sysconf(_SC_PAGESIZE));
+          pages[index] = nullptr;
+        }
+        if(fileDescriptors[index] >= 0) {
+          close(fileDescriptors[index]);
+          fileDescriptors[index] = -1;
+        }
+      }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // Reads a counter from user space as documented in linux/perf_event.h, false when rdpmc cannot be used
+    static bool ReadUserPage(const volatile perf_event_mmap_page* page, unsigned long long& value) {
+      unsigned int sequence;
+      long long count;
+      do {
+        sequence = page->lock;
+        std::atomic_signal_fence(std::memory_order_acquire);
+        const unsigned int index = page->index;
+        if(!page->cap_user_rdpmc || index == 0) {
+          return false;
+        }
+        unsigned int low;
+        unsigned int high;
+        __asm__ __volatile__("rdpmc" : "=a"(low), "=d"(high) : "c"(index - 1));
+        const unsigned int shift = 64 - page->pmc_width;
+        // The counter has pmc_width bits: sign extended
+        count = page->offset +
+                (static_cast<long long>((static_cast<unsigned long long>(high) << 32 | low) << shift) >> shift);
+        std::atomic_signal_fence(std::memory_order_acquire);
+      } while(page->lock != sequence);
+      value = static_cast<unsigned long long>(count);
+      return true;
+    }
+#endif
+
+    void Read(TraceDebugCounters& counters) {
+#if defined(__x86_64__) || defined(__i386__)
+      if(pages[0] != nullptr) {
+        unsigned int index = 0;
+        while(index < TraceDebugCounters::count && pages[index] != nullptr &&
+              ReadUserPage(pages[index], counters.values[index])) {
+          ++index;
+        }
+        if(index == TraceDebugCounters::count) {
+          return;
+        }
+      }
+#endif
+      // Number of counters followed by their values
+      unsigned long long values[1 + TraceDebugCounters::count];
+      if(read(fileDescriptors[0], values, sizeof(values)) == static_cast<ssize_t>(sizeof(values))) {
+        std::copy(values + 1, values + 1 + TraceDebugCounters::count, counters.values);
+      } else {
+        std::fill(counters.values, counters.values + TraceDebugCounters::count, 0ULL);
+      }
+    }
+
+    ~ThreadPerfCounters() {
+      Close();
+    }
+  };
 
-  // Automatically add a trace point when constructor is called
-  const std::string startMeasure = "Start measure";
-  AddTrace(std::chrono::steady_clock::now(), startMeasure);
-  if(displayStartTracePerformance) {
-    TraceDebug::PrintString(TraceDebug::GetDiffTimeSinceStartAndThreadId() + ":" + lineHeader + "  " + startMeasure, true);
+  thread_local ThreadPerfCounters threadPerfCounters;
+}
+
+// ==============================================================================================================================
+namespace {
+  // " [cycles 1234, instructions 5678, ...]", empty when no counter could be opened or none was read (traced locks)
+  std::string FormatCounters(const TraceDebugCounters& from, const TraceDebugCounters& to) {
+    if(TraceDebugPerfCounters::GetName(0) == nullptr ||
+       std::equal(from.values, from.values + TraceDebugCounters::count, to.values)) {
+      return std::string();
+    }
+    std::string text = " [";
+    for(unsigned int index = 0; index < TraceDebugCounters::count; ++index) {
+      text += std::string(index == 0 ? "" : ", ") + TraceDebugPerfCounters::GetName(index) + " " +
+              std::to_string(to.values[index] - from.values[index]);
+    }
+    return text + "]";
   }
 }
 
 // ==============================================================================================================================
-TraceDebug::TraceDebug(const std::string & functionName, const std::string & fileName, int lineNumber) {
-  std::string uniqueKey = GetUniqueKey(fileName, functionName);
-  // If key does not exist or key exists and current line is being accessed
-  GET_THREAD_SAFE_GUARD;
-  if(mapFileNameToLine.find(uniqueKey) == mapFileNameToLine.end() ||
-     mapFileNameToLine[uniqueKey] == lineNumber) {
-    // Remember the key name to erase in destructor
-    keyDebugPrintToErase = uniqueKey;
-    // Save line number
-    mapFileNameToLine[uniqueKey] = lineNumber;
-    // Increase deepness (this will increase the number of spaces when displaying the output thus giving a more comprehensive
-    // path of the call stack being involved)
-    IncreaseDebugPrintDeepness();
-    // Notify the deepness must be decremented in desctructor (which is not the case for performance measurement)
-    debugPrintMustBeDecremented = true;
+void TraceDebugPerfCounters::Read(TraceDebugCounters& counters) {
+  ThreadPerfCounters& thread = threadPerfCounters;
+  if(!thread.opened) {
+    thread.opened = true;
+    if(!perfEventsChosen.load(std::memory_order_acquire)) {
+      // Another thread may choose at the same time: both end up with the same choice
+      const PerfEvent* events = nullptr;
+      if(thread.Open(hardwareEvents)) {
+        events = hardwareEvents;
+      } else if(thread.Open(softwareEvents)) {
+        events = softwareEvents;
+      } else {
+        std::cerr << "TraceDebug: perf_event_open failed, performance counters are not available "
+                     "(see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+      }
+      perfEvents.store(events, std::memory_order_relaxed);
+      perfEventsChosen.store(true, std::memory_order_release);
+    } else if(perfEvents.load(std::memory_order_relaxed) != nullptr) {
+      thread.Open(perfEvents.load(std::memory_order_relaxed));
+    }
   }
+  if(thread.fileDescriptors[0] < 0) {
+    std::fill(counters.values, counters.values + TraceDebugCounters::count, 0ULL);
+    return;
+  }
+  thread.Read(counters);
 }
 
 // ==============================================================================================================================
-TraceDebug::~TraceDebug() {
-  GET_THREAD_SAFE_GUARD;
-  // Display performance informations
-  if(debugPerformanceMustBeDisplayed) {
-    DisplayPerformanceMeasure();
-    mapFileNameFunctionNameToVectorTimingInfo.erase(keyDebugPerformanceToErase);
+const char* TraceDebugPerfCounters::GetName(unsigned int index) {
+  const PerfEvent* events = perfEvents.load(std::memory_order_relaxed);
+  return events != nullptr && index < TraceDebugCounters::count ? events[index].name : nullptr;
+}
+#endif
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+namespace {
+  // Constant initialized: usable by operator new before any constructor ran and after the thread destructors
+  struct ThreadAllocations {
+    unsigned long long count;
+    unsigned long long bytes;
+    // Depth of the TraceDebugAllocationCounter::Ignore of the thread
+    unsigned int ignored;
+  };
+
+  thread_local ThreadAllocations threadAllocations = {0, 0, 0};
+
+  void* Allocate(std::size_t size) {
+    ThreadAllocations& allocations = threadAllocations;
+    if(allocations.ignored == 0) {
+      ++allocations.count;
+      allocations.bytes += size;
+    }
+    for(;;) {
+      if(void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+      }
+      std::new_handler handler = std::get_new_handler();
+      if(handler == nullptr) {
+        throw std::bad_alloc();
+      }
+      handler();
+    }
   }
+}
 
-  // Manage hierachy information (number of spaces)
-  if((debugPrintMustBeDecremented || debugPerformanceMustBeDisplayed) && GetDebugPrintDeepness() > 0) {
-    DecreaseDebugPrintDeepness();
-    if(debugPrintMustBeDecremented) {
-      mapFileNameToLine.erase(keyDebugPrintToErase);
+// ==============================================================================================================================
+void TraceDebugAllocationCounter::Read(TraceDebugAllocations& allocations) {
+  allocations.count = threadAllocations.count;
+  allocations.bytes = threadAllocations.bytes;
+}
+
+// ==============================================================================================================================
+TraceDebugAllocationCounter::Ignore::Ignore() {
+  ++threadAllocations.ignored;
+}
+
+// ==============================================================================================================================
+TraceDebugAllocationCounter::Ignore::~Ignore() {
+  --threadAllocations.ignored;
+}
+
+// ==============================================================================================================================
+// Array and nothrow forms call these ones
+void* operator new(std::size_t size) {
+  return Allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return Allocate(size);
+  } catch(...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  std::free(pointer);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+#endif
+#endif
+
+// ==============================================================================================================================
+TraceDebugCallSite::TraceDebugCallSite(const char* functionName, const char* scopeFileName, const char* fileName,
+                                       int lineNumber, const char* label, TraceDebugCallSiteKind kind):
+  functionName(functionName), fileName(fileName), lineNumber(lineNumber), label(label), id(0), scopeId(0),
+  enabled(true), sampling(nullptr), nextSampleTime(0), skippedCalls(0), kind(kind), contentions(0)
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  , slowThreshold(0), nextDumpTime(0), undumpedSlowCalls(0)
+#endif
+{
+  TraceDebug::RegisterCallSite(*this, scopeFileName);
+}
+
+// ==============================================================================================================================
+void TraceDebug::RegisterCallSite(TraceDebugCallSite& callSite, const char* scopeFileName) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+  callSite.id = static_cast<unsigned int>(callSites.size());
+  callSites.push_back(&callSite);
+  // Strings are only compared here: traces use the ids
+  auto scopeIdIt = scopeIds.emplace(std::string(scopeFileName) + callSite.functionName,
+                                    static_cast<unsigned int>(scopeIds.size())).first;
+  callSite.scopeId = scopeIdIt->second;
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  // The call sites measuring the overhead always do their traces
+  if(overheadMeasure != nullptr) {
+    return;
+  }
+#endif
+  // The last rule set wins
+  LoadEnableRules();
+  for(const auto& rule: enableRules) {
+    if(IsCallSiteMatching(rule.first, callSite)) {
+      callSite.enabled.store(rule.second, std::memory_order_relaxed);
+    }
+  }
+  for(const auto& rule: samplingRules) {
+    if(IsCallSiteMatching(rule.first, callSite)) {
+      callSite.sampling.store(rule.second, std::memory_order_release);
+    }
+  }
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  for(const auto& rule: slowThresholdRules) {
+    if(IsCallSiteMatching(rule.first, callSite)) {
+      callSite.slowThreshold.store(rule.second, std::memory_order_relaxed);
     }
   }
+#endif
+}
 
-  if(GetAllDebugPrintDeepness() == 0) {
-    mapFileNameToLine.clear();
+// ==============================================================================================================================
+void TraceDebug::LoadEnableRules() {
+  if(enableRulesLoaded) {
+    return;
+  }
+  enableRulesLoaded = true;
+  const char* environment = std::getenv("TRACE_DEBUG_ENABLE");
+  if(environment == nullptr) {
+    return;
+  }
+  // Comma separated names, disabled when preceded by '-'
+  std::stringstream rules(environment);
+  std::string rule;
+  while(std::getline(rules, rule, ',')) {
+    rule.erase(0, rule.find_first_not_of(" \t"));
+    rule.erase(rule.find_last_not_of(" \t") + 1);
+    bool enabled = true;
+    if(!rule.empty() && (rule[0] == '-' || rule[0] == '+')) {
+      enabled = rule[0] == '+';
+      rule.erase(0, 1);
+    }
+    if(!rule.empty()) {
+      enableRules.emplace_back(rule, enabled);
+    }
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::SetEnabled(const std::string& callSiteName, bool enabled) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+  LoadEnableRules();
+  enableRules.emplace_back(callSiteName, enabled);
+  for(const TraceDebugCallSite* registeredCallSite: callSites) {
+    if(IsCallSiteMatching(callSiteName, *registeredCallSite)) {
+      registeredCallSite->enabled.store(enabled, std::memory_order_relaxed);
+    }
+  }
+}
+
+// ==============================================================================================================================
+TraceDebugSampling TraceDebugSampling::OneIn(unsigned long long period) {
+  TraceDebugSampling sampling;
+  sampling.mode = Mode::OneIn;
+  sampling.period = period > 0 ? period : 1;
+  return sampling;
+}
+
+// ==============================================================================================================================
+TraceDebugSampling TraceDebugSampling::Probability(double probability) {
+  if(probability >= 1.) {
+    return OneIn(1);
+  }
+  TraceDebugSampling sampling;
+  sampling.mode = Mode::Probability;
+  sampling.threshold = probability > 0. ? static_cast<unsigned long long>(std::ldexp(probability, 64)) : 0;
+  return sampling;
+}
+
+// ==============================================================================================================================
+TraceDebugSampling TraceDebugSampling::PerSecond(double tracesPerSecond) {
+  TraceDebugSampling sampling;
+  sampling.mode = Mode::PerSecond;
+  if(tracesPerSecond > 0.) {
+    sampling.interval = std::max<long long>(1, TraceDebugClock::FromNanoseconds(std::llround(1e9 / tracesPerSecond)));
+    // The bucket holds one second of traces
+    sampling.tolerance = static_cast<long long>(std::max(0., std::floor(tracesPerSecond) - 1.)) * sampling.interval;
+  } else {
+    // No trace is ever done
+    sampling.interval = std::numeric_limits<long long>::max() / 2;
+    sampling.tolerance = -1;
+  }
+  return sampling;
+}
+
+// ==============================================================================================================================
+bool TraceDebug::IsGlobMatching(const char* pattern, const char* text) {
+  // Backtracks to the last '*' only: linear enough for call site names
+  const char* starPattern = nullptr;
+  const char* starText = nullptr;
+  while(*text != '\0') {
+    if(*pattern == '*') {
+      starPattern = pattern++;
+      starText = text;
+    } else if(*pattern == '?' || *pattern == *text) {
+      ++pattern;
+      ++text;
+    } else if(starPattern != nullptr) {
+      pattern = starPattern + 1;
+      text = ++starText;
+    } else {
+      return false;
+    }
+  }
+  while(*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
+}
+
+// ==============================================================================================================================
+bool TraceDebug::IsCallSiteMatching(const std::string& callSiteName, const TraceDebugCallSite& callSite) {
+  const char* pattern = callSiteName.c_str();
+  return IsGlobMatching(pattern, callSite.label) || IsGlobMatching(pattern, callSite.functionName) ||
+         IsGlobMatching(pattern, callSite.fileName) ||
+         IsGlobMatching(pattern, (std::string(callSite.fileName) + ":" + std::to_string(callSite.lineNumber)).c_str());
+}
+
+// ==============================================================================================================================
+void TraceDebug::SetSampling(const std::string& callSiteName, const TraceDebugSampling& sampling) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+  const TraceDebugSampling* policy = nullptr;
+  // Doing all the traces does not need any policy
+  if(sampling.mode != TraceDebugSampling::Mode::OneIn || sampling.period > 1) {
+    samplingPolicies.push_back(sampling);
+    policy = &samplingPolicies.back();
+  }
+  samplingRules.emplace_back(callSiteName, policy);
+  for(const TraceDebugCallSite* registeredCallSite: callSites) {
+    if(IsCallSiteMatching(callSiteName, *registeredCallSite)) {
+      registeredCallSite->sampling.store(policy, std::memory_order_release);
+    }
+  }
+}
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+void TraceDebug::SetSlowThreshold(const std::string& callSiteName, std::chrono::nanoseconds threshold) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+  const TraceDebugClock::Ticks ticks = threshold.count() > 0 ? std::max<TraceDebugClock::Ticks>(1,
+                                         TraceDebugClock::FromNanoseconds(threshold.count())) : 0;
+  slowThresholdRules.emplace_back(callSiteName, ticks);
+  for(const TraceDebugCallSite* registeredCallSite: callSites) {
+    if(IsCallSiteMatching(callSiteName, *registeredCallSite)) {
+      registeredCallSite->slowThreshold.store(ticks, std::memory_order_relaxed);
+    }
+  }
+}
+#endif
+
+// ==============================================================================================================================
+bool TraceDebug::Sample(const TraceDebugSampling& sampling, const TraceDebugCallSite& callSite) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  std::vector<TraceDebugSamplingState>& states = samplingStates.callSites;
+  if(states.size() <= callSite.id) {
+    states.resize(callSite.id + 1);
+  }
+  TraceDebugSamplingState& state = states[callSite.id];
+  bool isSampled = false;
+  switch(sampling.mode) {
+    case TraceDebugSampling::Mode::OneIn:
+      isSampled = state.calls % sampling.period == 0;
+      break;
+    case TraceDebugSampling::Mode::Probability: {
+      unsigned long long& random = samplingStates.random;
+      if(random == 0) {
+        random = (std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                  static_cast<unsigned long long>(TraceDebugClock::Now())) | 1;
+      }
+      // xorshift64*
+      random ^= random >> 12;
+      random ^= random << 25;
+      random ^= random >> 27;
+      isSampled = random * 2685821657736338717ULL < sampling.threshold;
+      break;
+    }
+    case TraceDebugSampling::Mode::PerSecond: {
+      // Generic cell rate algorithm: a token bucket shared by all threads in a single atomic
+      const TraceDebugClock::Ticks now = TraceDebugClock::Now();
+      long long nextSampleTime = callSite.nextSampleTime.load(std::memory_order_relaxed);
+      while(nextSampleTime - now <= sampling.tolerance) {
+        if(callSite.nextSampleTime.compare_exchange_weak(nextSampleTime, std::max(nextSampleTime, now) + sampling.interval,
+                                                         std::memory_order_relaxed)) {
+          isSampled = true;
+          break;
+        }
+      }
+      break;
+    }
+  }
+  ++state.calls;
+  // Skipped calls are shared by batches to keep the call site out of the cache of other threads
+  if(isSampled ? state.skippedCalls > 0 : ++state.skippedCalls >= 256) {
+    callSite.skippedCalls.fetch_add(state.skippedCalls, std::memory_order_relaxed);
+    state.skippedCalls = 0;
+  }
+  return isSampled;
+}
+
+// ==============================================================================================================================
+void TraceDebug::FlushSkippedCalls(TraceDebugSamplingStates& states) {
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+  for(size_t id = 0; id < states.callSites.size() && id < callSites.size(); ++id) {
+    if(states.callSites[id].skippedCalls > 0) {
+      callSites[id]->skippedCalls.fetch_add(states.callSites[id].skippedCalls, std::memory_order_relaxed);
+      states.callSites[id].skippedCalls = 0;
+    }
+  }
+}
+
+// ==============================================================================================================================
+#ifdef ENABLE_THREAD_SAFE
+TraceDebugSamplingStates::~TraceDebugSamplingStates() {
+  TraceDebug::FlushSkippedCalls(*this);
+}
+#endif
+
+// ==============================================================================================================================
+void TraceDebug::OutputSkippedCalls(const std::vector<bool>& statisticsDisplayed) {
+  FlushSkippedCalls(samplingStates);
+  std::vector<const TraceDebugCallSite*> registeredCallSites;
+  {
+#ifdef ENABLE_THREAD_SAFE
+    std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+    registeredCallSites = callSites;
+  }
+  for(const TraceDebugCallSite* site: registeredCallSites) {
+    const unsigned long long skippedCalls = site->skippedCalls.load(std::memory_order_relaxed);
+    if(skippedCalls == 0 || (site->id < statisticsDisplayed.size() && statisticsDisplayed[site->id])) {
+      continue;
+    }
+    TraceDebugEvent event = CreateEvent(TraceDebugEventKind::Text, false);
+    event.text = std::string(site->fileName) + ":" + std::to_string(site->lineNumber) + " (" + site->functionName + ") [" +
+                 site->label + "]: " + std::to_string(skippedCalls) + " traces skipped by sampling";
+    CacheOrPrintOutputs(std::move(event));
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::StartTrace(bool measurePerformance) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  // Measured by the first trace of the program, the traces done meanwhile by other threads wait for it
+  if(overheadMeasure == nullptr) {
+    static const bool overheadMeasured = (MeasureOverhead(), true);
+    (void)overheadMeasured;
+  }
+#endif
+  // Decided before anything else: a skipped trace costs as little as possible
+  const TraceDebugSampling* sampling = callSite.sampling.load(std::memory_order_acquire);
+  if(sampling != nullptr && !Sample(*sampling, callSite)) {
+    traced = false;
+    return;
+  }
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+  // Only measures are open scopes: a displayed value is over once displayed
+  if(measurePerformance) {
+    threadScopes.Push(callSite, TraceDebugClock::Now());
+  }
+#endif
+  GET_THREAD_SAFE_GUARD;
+  if(measurePerformance) {
+    debugPerformanceMustBeDisplayed = true;
+    IncreaseDebugPrintDeepness();
+    measureIndex = measureCount++;
+    if(measureTimings.size() < measureCount) {
+      measureTimings.resize(measureCount);
+    }
+
+    // Automatically add a trace point when constructor is called
+    const TraceDebugClock::Ticks startTime = TraceDebugClock::Now();
+    AddTimePoint(startTime, "Start measure");
+#ifdef TRACE_DEBUG_CALL_TREE
+    EnterCallTree();
+#endif
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+    // Only statistics are displayed
+    return;
+#endif
+    if(displayStartTracePerformance) {
+      TraceDebugEvent event = CreateEvent(TraceDebugEventKind::StartMeasure, true, startTime);
+      event.callSite = &callSite;
+      DispatchEvent(std::move(event));
+    }
+    return;
+  }
+
+  if(scopeLines.size() <= callSite.scopeId) {
+    scopeLines.resize(callSite.scopeId + 1, 0);
+  }
+  // If no trace is being done in this function or the current line is being accessed
+  int& scopeLine = scopeLines[callSite.scopeId];
+  if(scopeLine == 0 || scopeLine == callSite.lineNumber) {
+    // Save line number
+    scopeLine = callSite.lineNumber;
+    // Increase deepness (this will increase the number of spaces when displaying the output thus giving a more comprehensive
+    // path of the call stack being involved)
+    IncreaseDebugPrintDeepness();
+    // Notify the deepness must be decremented in desctructor (which is not the case for performance measurement)
+    debugPrintMustBeDecremented = true;
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::EndTrace() {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  GET_THREAD_SAFE_GUARD;
+  // Display performance informations
+  if(debugPerformanceMustBeDisplayed) {
+    DisplayPerformanceMeasure();
+    // Keeps the capacity for the next measure at this nesting level
+    measureTimings[measureIndex].clear();
+    --measureCount;
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+    // The measures this one is nested in see its whole cost
+    threadOverhead += overhead.scope - overhead.scopeInside;
+#endif
+  }
+
+  // Manage hierachy information (number of spaces)
+  if((debugPrintMustBeDecremented || debugPerformanceMustBeDisplayed) && GetDebugPrintDeepness() > 0) {
+    DecreaseDebugPrintDeepness();
+    if(debugPrintMustBeDecremented) {
+      scopeLines[callSite.scopeId] = 0;
+    }
+  }
+
+  if(GetAllDebugPrintDeepness() == 0) {
+    std::fill(scopeLines.begin(), scopeLines.end(), 0);
+  }
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+  if(debugPerformanceMustBeDisplayed) {
+    threadScopes.Pop();
+  }
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::DisplayPerformanceMeasure() {
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  // This measure only sees its own cost
+  threadOverhead += overhead.scopeInside;
+#endif
+  // Automatically add an end of measure trace points when getting out of scope
+  AddTimePoint(TraceDebugClock::Now(), "End measure");
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  if(overheadMeasure != nullptr) {
+    const TraceDebugTimings& timings = measureTimings[measureIndex];
+    *overheadMeasure = timings.back().time - timings.front().time;
+  }
+#endif
+#ifdef TRACE_DEBUG_CALL_TREE
+  LeaveCallTree(measureTimings[measureIndex]);
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  const bool slowCall = IsSlowCall(callSite, measureTimings[measureIndex]);
+#endif
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+  AddStatistics(callSite, measureTimings[measureIndex]);
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  // The results of the slow measure are displayed even though the others only go to the statistics
+  if(slowCall) {
+    RecordEvent(CreatePerformanceEvent(false));
+    DumpFlightRecorder(callSite, measureTimings[measureIndex]);
+  }
+#endif
+  return;
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  // The trace points of a slow call are still needed to dump it
+  TraceDebugEvent timingInformation = CreatePerformanceEvent(!slowCall);
+#else
+  TraceDebugEvent timingInformation = CreatePerformanceEvent(true);
+#endif
+  // If the number of information stored is greater than 1 a difference can be computed
+  if(timingInformation.timings.size() > 1) CacheOrPrintTimings(std::move(timingInformation));
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  if(slowCall) {
+    DumpFlightRecorder(callSite, measureTimings[measureIndex]);
+  }
+#endif
+}
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_CALL_TREE
+unsigned int TraceDebugCallTree::GetChild(unsigned int parent, unsigned int callSiteId) {
+  for(unsigned int child: nodes[parent].children) {
+    if(nodes[child].callSiteId == callSiteId) {
+      return child;
+    }
+  }
+  const unsigned int child = static_cast<unsigned int>(nodes.size());
+  nodes.emplace_back();
+  nodes.back().callSiteId = callSiteId;
+  nodes.back().parent = parent;
+  nodes[parent].children.push_back(child);
+  return child;
+}
+
+// ==============================================================================================================================
+void TraceDebugCallTree::Merge(const TraceDebugCallTree& other, unsigned int otherNode, unsigned int node) {
+  for(unsigned int otherChild: other.nodes[otherNode].children) {
+    const TraceDebugCallTreeNode& source = other.nodes[otherChild];
+    const unsigned int child = GetChild(node, source.callSiteId);
+    nodes[child].calls += source.calls;
+    nodes[child].totalTime += source.totalTime;
+    nodes[child].childrenTime += source.childrenTime;
+    Merge(other, otherChild, child);
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::EnterCallTree() {
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  // The measures of the overhead are not part of the program
+  if(overheadMeasure != nullptr) {
+    return;
+  }
+#endif
+  TraceDebugCallTree& tree = GetThreadCallTree();
+#ifdef ENABLE_THREAD_SAFE
+  // Only taken by another thread when the call tree is displayed
+  std::lock_guard<std::mutex> lock(tree.mutex);
+#endif
+  const unsigned int parent = tree.stack.empty() ? 0 : tree.stack.back();
+  tree.stack.push_back(tree.GetChild(parent, callSite.id));
+}
+
+// ==============================================================================================================================
+TraceDebugCallTree& TraceDebug::GetThreadCallTree() {
+  if(!callTree) {
+    // Display the call tree when the program ends
+    FinalizeAtExit();
+    callTree = std::make_shared<TraceDebugCallTree>();
+    std::lock_guard<std::mutex> lock(callTreesMutex);
+    callTrees.push_back(callTree);
+  }
+  return *callTree;
+}
+
+// ==============================================================================================================================
+void TraceDebug::LeaveCallTree(const TraceDebugTimings& timings) {
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  if(overheadMeasure != nullptr) {
+    return;
+  }
+  const TraceDebugClock::Ticks duration = GetCorrectedDuration(timings.front(), timings.back());
+#else
+  const TraceDebugClock::Ticks duration = timings.back().time - timings.front().time;
+#endif
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(callTree->mutex);
+#endif
+  const unsigned int node = callTree->stack.back();
+  callTree->stack.pop_back();
+  TraceDebugCallTreeNode& callTreeNode = callTree->nodes[node];
+  ++callTreeNode.calls;
+  callTreeNode.totalTime += duration;
+  // The nodes of a restored context did not wait for this measure
+  if(callTree->contextDepth == 0 || callTree->stack.size() > callTree->contextDepth) {
+    callTree->nodes[callTreeNode.parent].childrenTime += duration;
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::MergeCallTrees(TraceDebugCallTree& result) {
+  std::lock_guard<std::mutex> lock(callTreesMutex);
+  for(auto it = callTrees.begin(); it != callTrees.end();) {
+    // Only referenced by this list: the thread exited, its call tree is kept apart
+    const bool threadExited = it->use_count() == 1;
+    {
+#ifdef ENABLE_THREAD_SAFE
+      std::lock_guard<std::mutex> treeLock((*it)->mutex);
+#endif
+      (threadExited ? exitedThreadsCallTree : result).Merge(**it);
+    }
+    if(threadExited) {
+      it = callTrees.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  result.Merge(exitedThreadsCallTree);
+}
+
+// ==============================================================================================================================
+void TraceDebug::OutputCallTree(unsigned int topCount) {
+  TraceDebugCallTree tree;
+  MergeCallTrees(tree);
+  std::vector<const TraceDebugCallSite*> registeredCallSites;
+  {
+#ifdef ENABLE_THREAD_SAFE
+    std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+    registeredCallSites = callSites;
+  }
+  // Call sites found at several paths are summed up
+  struct CallSiteTimes {
+    unsigned int id;
+    unsigned long long calls;
+    TraceDebugClock::Ticks totalTime;
+    TraceDebugClock::Ticks selfTime;
+  };
+  std::vector<CallSiteTimes> callSiteTimes;
+  std::vector<size_t> callSiteIndexes(registeredCallSites.size(), std::numeric_limits<size_t>::max());
+  TraceDebugClock::Ticks measuredTime = 0;
+  for(size_t node = 1; node < tree.nodes.size(); ++node) {
+    const TraceDebugCallTreeNode& treeNode = tree.nodes[node];
+    size_t& index = callSiteIndexes[treeNode.callSiteId];
+    if(index == std::numeric_limits<size_t>::max()) {
+      index = callSiteTimes.size();
+      callSiteTimes.push_back(CallSiteTimes{treeNode.callSiteId, 0, 0, 0});
+    }
+    const TraceDebugClock::Ticks selfTime = std::max<TraceDebugClock::Ticks>(0, treeNode.totalTime - treeNode.childrenTime);
+    callSiteTimes[index].calls += treeNode.calls;
+    callSiteTimes[index].totalTime += treeNode.totalTime;
+    callSiteTimes[index].selfTime += selfTime;
+    measuredTime += selfTime;
+  }
+  if(callSiteTimes.empty()) {
+    return;
+  }
+  std::sort(callSiteTimes.begin(), callSiteTimes.end(),
+            [](const CallSiteTimes& left, const CallSiteTimes& right) { return left.selfTime > right.selfTime; });
+
+  TraceDebugEvent title = CreateEvent(TraceDebugEventKind::Text, false);
+  title.text = "Call tree: " + std::to_string(callSiteTimes.size()) + " call sites, " + FormatDuration(measuredTime) +
+               " measured, highest self times:";
+  CacheOrPrintOutputs(std::move(title));
+  for(size_t rank = 0; rank < callSiteTimes.size() && rank < topCount; ++rank) {
+    const CallSiteTimes& times = callSiteTimes[rank];
+    const TraceDebugCallSite& site = *registeredCallSites[times.id];
+    std::stringstream percentage;
+    percentage << std::fixed << std::setprecision(1) << 100. * times.selfTime / std::max<TraceDebugClock::Ticks>(1, measuredTime);
+    TraceDebugEvent event = CreateEvent(TraceDebugEventKind::Text, false);
+    event.text = std::to_string(rank + 1) + ". " + site.fileName + ":" + std::to_string(site.lineNumber) + " (" +
+                 site.functionName + ") [" + site.label + "]: self " + FormatDuration(times.selfTime) + " (" +
+                 percentage.str() + "%), total " + FormatDuration(times.totalTime) + ", calls " + std::to_string(times.calls);
+    CacheOrPrintOutputs(std::move(event));
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::PrintCallTree(unsigned int topCount) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  GET_OUTPUT_GUARD;
+  OutputCallTree(topCount);
+}
+
+// ==============================================================================================================================
+void TraceDebug::WriteFoldedStacks(const std::string& fileName) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  TraceDebugCallTree tree;
+  MergeCallTrees(tree);
+  std::vector<const TraceDebugCallSite*> registeredCallSites;
+  {
+#ifdef ENABLE_THREAD_SAFE
+    std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+    registeredCallSites = callSites;
+  }
+  std::ofstream output(fileName);
+  // Depth first, the frames of the current path are kept in stack
+  std::vector<std::pair<unsigned int, std::string>> pending(1, std::make_pair(0U, std::string()));
+  while(!pending.empty()) {
+    const unsigned int node = pending.back().first;
+    const std::string stack = std::move(pending.back().second);
+    pending.pop_back();
+    const TraceDebugCallTreeNode& treeNode = tree.nodes[node];
+    if(node != 0) {
+      const long long selfTime = TraceDebugClock::ToNanoseconds(std::max<TraceDebugClock::Ticks>(0, treeNode.totalTime -
+                                                                                                        treeNode.childrenTime));
+      if(selfTime > 0) {
+        output << stack << " " << selfTime << "\n";
+      }
+    }
+    for(unsigned int child: treeNode.children) {
+      const TraceDebugCallSite& site = *registeredCallSites[tree.nodes[child].callSiteId];
+      pending.emplace_back(child, (stack.empty() ? std::string() : stack + ";") + site.functionName + " [" + site.label + "]");
+    }
+  }
+}
+#endif
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+namespace {
+  // Segments are usually found at the same index for each measure of a call site
+  TraceDebugSegmentStatistics& GetSegmentStatistics(std::vector<TraceDebugSegmentStatistics>& segments, size_t expectedIndex,
+                                                    const char* fromLabel, const char* toLabel) {
+    if(expectedIndex < segments.size() && segments[expectedIndex].fromLabel == fromLabel &&
+       segments[expectedIndex].toLabel == toLabel) {
+      return segments[expectedIndex];
+    }
+    for(auto& segment: segments) {
+      if(segment.fromLabel == fromLabel && segment.toLabel == toLabel) {
+        return segment;
+      }
+    }
+    segments.emplace_back();
+    segments.back().fromLabel = fromLabel;
+    segments.back().toLabel = toLabel;
+    return segments.back();
+  }
+
+  unsigned long long GetNanoseconds(TraceDebugClock::Ticks ticks) {
+    return static_cast<unsigned long long>(TraceDebugClock::ToNanoseconds(ticks));
+  }
+
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+  void AddCounters(TraceDebugSegmentStatistics& segment, const TraceDebugTiming& from, const TraceDebugTiming& to) {
+    for(unsigned int index = 0; index < TraceDebugCounters::count; ++index) {
+      segment.counterSums[index] += to.counters.values[index] - from.counters.values[index];
+    }
+  }
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+  void AddAllocations(TraceDebugSegmentStatistics& segment, const TraceDebugTiming& from, const TraceDebugTiming& to) {
+    segment.allocationSums.count += to.allocations.count - from.allocations.count;
+    segment.allocationSums.bytes += to.allocations.bytes - from.allocations.bytes;
+  }
+#endif
+}
+
+void TraceDebug::AddStatistics(const TraceDebugCallSite& callSite, const TraceDebugTimings& timings) {
+  if(!statisticsShard) {
+    // Display the statistics when the program ends
+    FinalizeAtExit();
+    statisticsShard = std::make_shared<TraceDebugStatisticsShard>();
+    std::lock_guard<std::mutex> lock(statisticsShardsMutex);
+    statisticsShards.push_back(statisticsShard);
+  }
+#ifdef ENABLE_THREAD_SAFE
+  // Only taken by another thread when statistics are displayed
+  std::lock_guard<std::mutex> lock(statisticsShard->mutex);
+#endif
+  auto& shardCallSites = statisticsShard->callSites;
+  if(shardCallSites.size() <= callSite.id) {
+    shardCallSites.resize(callSite.id + 1);
+  }
+  auto& segments = shardCallSites[callSite.id];
+  const size_t size = timings.size() - 1;
+  for(size_t index = 0; index < size; ++index) {
+    TraceDebugSegmentStatistics& segment = GetSegmentStatistics(segments, index, timings[index].label, timings[index + 1].label);
+    const unsigned long long duration = GetNanoseconds(timings[index + 1].time - timings[index].time);
+    segment.histogram.Add(duration);
+#ifdef TRACE_DEBUG_TIME_SERIES
+    segment.windowHistogram.Add(duration);
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+    segment.correctedHistogram.Add(GetNanoseconds(GetCorrectedDuration(timings[index], timings[index + 1])));
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+    AddCounters(segment, timings[index], timings[index + 1]);
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+    AddAllocations(segment, timings[index], timings[index + 1]);
+#endif
+  }
+  if(size > 1) {
+    TraceDebugSegmentStatistics& segment = GetSegmentStatistics(segments, size, "", "Full time");
+    const unsigned long long duration = GetNanoseconds(timings[size].time - timings[0].time);
+    segment.histogram.Add(duration);
+#ifdef TRACE_DEBUG_TIME_SERIES
+    segment.windowHistogram.Add(duration);
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+    segment.correctedHistogram.Add(GetNanoseconds(GetCorrectedDuration(timings[0], timings[size])));
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+    AddCounters(segment, timings[0], timings[size]);
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+    AddAllocations(segment, timings[0], timings[size]);
+#endif
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::MergeStatistics(const TraceDebugStatisticsShard& shard, TraceDebugStatisticsShard& result) {
+  if(result.callSites.size() < shard.callSites.size()) {
+    result.callSites.resize(shard.callSites.size());
+  }
+  for(size_t id = 0; id < shard.callSites.size(); ++id) {
+    const auto& segments = shard.callSites[id];
+    for(size_t index = 0; index < segments.size(); ++index) {
+      TraceDebugSegmentStatistics& segment = GetSegmentStatistics(result.callSites[id], index, segments[index].fromLabel.c_str(),
+                                                                  segments[index].toLabel.c_str());
+      segment.histogram.Merge(segments[index].histogram);
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+      segment.correctedHistogram.Merge(segments[index].correctedHistogram);
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+      for(unsigned int counter = 0; counter < TraceDebugCounters::count; ++counter) {
+        segment.counterSums[counter] += segments[index].counterSums[counter];
+      }
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+      segment.allocationSums.count += segments[index].allocationSums.count;
+      segment.allocationSums.bytes += segments[index].allocationSums.bytes;
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+      segment.windowHistogram.Merge(segments[index].windowHistogram);
+#endif
+    }
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::OutputStatistics() {
+  TraceDebugStatisticsShard statistics;
+  {
+    std::lock_guard<std::mutex> lock(statisticsShardsMutex);
+    for(auto it = statisticsShards.begin(); it != statisticsShards.end();) {
+      // Only referenced by this list: the thread exited, its statistics are kept apart
+      const bool threadExited = it->use_count() == 1;
+      {
+#ifdef ENABLE_THREAD_SAFE
+        std::lock_guard<std::mutex> shardLock((*it)->mutex);
+#endif
+        MergeStatistics(**it, threadExited ? exitedThreadsStatistics : statistics);
+      }
+      if(threadExited) {
+        it = statisticsShards.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    MergeStatistics(exitedThreadsStatistics, statistics);
+  }
+
+  auto toUnit = [](double nanoseconds) {
+    return std::to_string(std::chrono::duration<double, UNIT_TRACE_TEMPLATE_TYPE>(
+                                  std::chrono::duration<double, std::nano>(nanoseconds)).count()) + UNIT_TRACE_DEBUG;
+  };
+  FlushSkippedCalls(samplingStates);
+  std::vector<const TraceDebugCallSite*> registeredCallSites;
+  {
+#ifdef ENABLE_THREAD_SAFE
+    std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+    registeredCallSites = callSites;
+  }
+  std::vector<bool> statisticsDisplayed(statistics.callSites.size(), false);
+  for(size_t id = 0; id < statistics.callSites.size(); ++id) {
+    const TraceDebugCallSite& site = *registeredCallSites[id];
+    const unsigned long long skippedCalls = site.skippedCalls.load(std::memory_order_relaxed);
+    statisticsDisplayed[id] = !statistics.callSites[id].empty();
+    for(const auto& segment: statistics.callSites[id]) {
+      const TraceDebugHistogram& histogram = segment.histogram;
+      TraceDebugEvent event = CreateEvent(TraceDebugEventKind::Text, false);
+      event.text = std::string(site.fileName) + ":" + std::to_string(site.lineNumber) + " (" + site.functionName + ") [" +
+                   site.label + "] " +
+                   (segment.fromLabel.empty() ? segment.toLabel : "<" + segment.toLabel + "> - <" + segment.fromLabel + ">") +
+                   ": count " + std::to_string(histogram.GetCount()) +
+                   ", mean " + toUnit(histogram.GetMean()) +
+                   ", min " + toUnit(static_cast<double>(histogram.GetMin())) +
+                   ", p50 " + toUnit(static_cast<double>(histogram.GetPercentile(0.5))) +
+                   ", p90 " + toUnit(static_cast<double>(histogram.GetPercentile(0.9))) +
+                   ", p99 " + toUnit(static_cast<double>(histogram.GetPercentile(0.99))) +
+                   ", p99.9 " + toUnit(static_cast<double>(histogram.GetPercentile(0.999))) +
+                   ", max " + toUnit(static_cast<double>(histogram.GetMax()));
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+      const TraceDebugHistogram& corrected = segment.correctedHistogram;
+      event.text += ", without traces: mean " + toUnit(corrected.GetMean()) +
+                    ", p50 " + toUnit(static_cast<double>(corrected.GetPercentile(0.5))) +
+                    ", p99 " + toUnit(static_cast<double>(corrected.GetPercentile(0.99)));
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+      // Traced locks and tasks do not read the counters
+      for(unsigned int counter = 0; counter < TraceDebugCounters::count && TraceDebugPerfCounters::GetName(0) != nullptr &&
+                                    site.kind == TraceDebugCallSiteKind::Trace; ++counter) {
+        event.text += std::string(", ") + TraceDebugPerfCounters::GetName(counter) + " mean " +
+                      std::to_string(segment.counterSums[counter] / std::max(1ULL, histogram.GetCount()));
+      }
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+      if(site.kind == TraceDebugCallSiteKind::Trace) {
+        const double count = static_cast<double>(std::max(1ULL, histogram.GetCount()));
+        std::ostringstream allocations;
+        allocations << std::fixed << std::setprecision(2) << ", allocations mean "
+                    << static_cast<double>(segment.allocationSums.count) / count << ", bytes mean "
+                    << static_cast<double>(segment.allocationSums.bytes) / count;
+        event.text += allocations.str();
+      }
+#endif
+      if(skippedCalls > 0) {
+        // Rates are extrapolated with count + skipped
+        event.text += ", skipped " + std::to_string(skippedCalls);
+      }
+      CacheOrPrintOutputs(std::move(event));
+    }
+    if(site.kind == TraceDebugCallSiteKind::Lock && !statistics.callSites[id].empty()) {
+      // Each lock is counted once by its wait segment
+      const unsigned long long locks = statistics.callSites[id].front().histogram.GetCount();
+      const unsigned long long contentions = site.contentions.load(std::memory_order_relaxed);
+      std::ostringstream rate;
+      rate << std::fixed << std::setprecision(2) << 100.0 * static_cast<double>(contentions) / static_cast<double>(locks);
+      TraceDebugEvent event = CreateEvent(TraceDebugEventKind::Text, false);
+      event.text = std::string(site.fileName) + ":" + std::to_string(site.lineNumber) + " [" + site.label +
+                   "] contention: " + std::to_string(contentions) + " of " + std::to_string(locks) + " locks (" +
+                   rate.str() + "%)";
+      CacheOrPrintOutputs(std::move(event));
+    }
+  }
+  OutputSkippedCalls(statisticsDisplayed);
+}
+
+// ==============================================================================================================================
+unsigned int TraceDebugHistogram::GetBucket(unsigned long long value) {
+  if(value < (1ULL << subBucketBits)) {
+    return static_cast<unsigned int>(value);
+  }
+#if defined(__GNUC__)
+  const unsigned int exponent = 63 - __builtin_clzll(value);
+#else
+  unsigned int exponent = 0;
+  for(unsigned long long shifted = value; shifted >>= 1;) ++exponent;
+#endif
+  return ((exponent - subBucketBits + 1) << subBucketBits) +
+         static_cast<unsigned int>((value >> (exponent - subBucketBits)) & ((1ULL << subBucketBits) - 1));
+}
+
+// ==============================================================================================================================
+unsigned long long TraceDebugHistogram::GetBucketMiddle(unsigned int bucket) {
+  if(bucket < (1U << subBucketBits)) {
+    return bucket;
+  }
+  const unsigned int exponent = (bucket >> subBucketBits) + subBucketBits - 1;
+  const unsigned long long subBucket = bucket & ((1U << subBucketBits) - 1);
+  const unsigned long long lowest = ((1ULL << subBucketBits) + subBucket) << (exponent - subBucketBits);
+  return lowest + ((1ULL << (exponent - subBucketBits)) >> 1);
+}
+
+// ==============================================================================================================================
+void TraceDebugHistogram::Add(unsigned long long value) {
+  ++buckets[GetBucket(value)];
+  if(count == 0 || value < min) min = value;
+  if(value > max) max = value;
+  ++count;
+  sum += value;
+}
+
+// ==============================================================================================================================
+void TraceDebugHistogram::Merge(const TraceDebugHistogram& other) {
+  if(other.count == 0) {
+    return;
+  }
+  for(unsigned int bucket = 0; bucket < bucketCount; ++bucket) {
+    buckets[bucket] += other.buckets[bucket];
+  }
+  if(count == 0 || other.min < min) min = other.min;
+  if(other.max > max) max = other.max;
+  count += other.count;
+  sum += other.sum;
+}
+
+// ==============================================================================================================================
+unsigned long long TraceDebugHistogram::GetPercentile(double percentile) const {
+  if(count == 0) {
+    return 0;
+  }
+  unsigned long long rank = static_cast<unsigned long long>(std::ceil(percentile * count));
+  if(rank == 0) rank = 1;
+  unsigned long long cumulated = 0;
+  for(unsigned int bucket = 0; bucket < bucketCount; ++bucket) {
+    cumulated += buckets[bucket];
+    if(cumulated >= rank) {
+      // The exact values are known at both ends
+      return std::min(std::max(GetBucketMiddle(bucket), min), max);
+    }
+  }
+  return max;
+}
+#endif
+
+// ==============================================================================================================================
+void TraceDebug::AddLockMeasure(const TraceDebugCallSite& lockSite, const TraceDebugLockTimes& times,
+                                TraceDebugClock::Ticks unlockedTime) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  if(overheadMeasure != nullptr) {
+    return;
+  }
+#endif
+  if(times.contended) {
+    lockSite.contentions.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Keeps the capacity of the labels from one lock to the next
+  static thread_local TraceDebugTimings timings(3, TraceDebugTiming());
+  timings[0].label = "Lock";
+  timings[0].time = times.lockTime;
+  timings[1].label = times.shared ? "Locked shared" : "Locked";
+  timings[1].time = times.lockedTime;
+  timings[2].label = "Unlocked";
+  timings[2].time = unlockedTime;
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+  AddStatistics(lockSite, timings);
+#else
+  GET_THREAD_SAFE_GUARD;
+  TraceDebugEvent event = CreateEvent(TraceDebugEventKind::EndMeasure, true, unlockedTime);
+  event.callSite = &lockSite;
+  event.timings = timings;
+  DispatchEvent(std::move(event));
+#endif
+}
+
+// ==============================================================================================================================
+TraceDebugContext TraceDebug::CaptureContext(const TraceDebugCallSite& taskSite) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  TraceDebugContext context;
+  if(!IsSiteTraced(taskSite)) {
+    return context;
+  }
+  context.callSite = &taskSite;
+  context.id = contextCount.fetch_add(1, std::memory_order_relaxed) + 1;
+  context.threadId = std::this_thread::get_id();
+  {
+    GET_THREAD_SAFE_GUARD;
+    context.deepness = GetDebugPrintDeepness();
+#ifdef TRACE_DEBUG_CALL_TREE
+    if(callTree) {
+#ifdef ENABLE_THREAD_SAFE
+      std::lock_guard<std::mutex> lock(callTree->mutex);
+#endif
+      for(unsigned int node: callTree->stack) {
+        context.callTreePath.push_back(callTree->nodes[node].callSiteId);
+      }
+    }
+#endif
+  }
+  context.submitTime = TraceDebugClock::Now();
+  return context;
+}
+
+// ==============================================================================================================================
+TraceDebugContextState TraceDebug::EnterContext(const TraceDebugContext& context) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  TraceDebugContextState state;
+  if(context.callSite == nullptr) {
+    return state;
+  }
+  const TraceDebugClock::Ticks startTime = TraceDebugClock::Now();
+  GET_THREAD_SAFE_GUARD;
+  // A deferred task runs in the thread which submitted it: its traces are already nested
+  if(context.threadId != std::this_thread::get_id()) {
+    state.deepness = context.deepness;
+    for(unsigned int level = 0; level < state.deepness; ++level) {
+      IncreaseDebugPrintDeepness();
+    }
+#ifdef TRACE_DEBUG_CALL_TREE
+    if(!context.callTreePath.empty()) {
+      TraceDebugCallTree& tree = GetThreadCallTree();
+#ifdef ENABLE_THREAD_SAFE
+      std::lock_guard<std::mutex> lock(tree.mutex);
+#endif
+      for(unsigned int callSiteId: context.callTreePath) {
+        tree.stack.push_back(tree.GetChild(tree.stack.empty() ? 0 : tree.stack.back(), callSiteId));
+      }
+      state.callTreeNodes = static_cast<unsigned int>(context.callTreePath.size());
+      state.previousContextDepth = tree.contextDepth;
+      tree.contextDepth = static_cast<unsigned int>(tree.stack.size());
+    }
+#endif
+  }
+
+  // Keeps the capacity of the labels from one task to the next
+  static thread_local TraceDebugTimings timings(2, TraceDebugTiming());
+  timings[0].label = "Submitted";
+  timings[0].time = context.submitTime;
+  timings[1].label = "Started";
+  timings[1].time = startTime;
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+  AddStatistics(*context.callSite, timings);
+#else
+  TraceDebugEvent event = CreateEvent(TraceDebugEventKind::EndMeasure, true, startTime);
+  event.callSite = context.callSite;
+  event.timings = timings;
+  event.contextId = context.id;
+  event.contextThreadId = context.threadId;
+  DispatchEvent(std::move(event));
+#endif
+  return state;
+}
+
+// ==============================================================================================================================
+void TraceDebug::LeaveContext(const TraceDebugContextState& state) {
+  GET_THREAD_SAFE_GUARD;
+  for(unsigned int level = 0; level < state.deepness; ++level) {
+    DecreaseDebugPrintDeepness();
+  }
+#ifdef TRACE_DEBUG_CALL_TREE
+  if(state.callTreeNodes > 0) {
+#ifdef ENABLE_THREAD_SAFE
+    std::lock_guard<std::mutex> lock(callTree->mutex);
+#endif
+    callTree->stack.resize(callTree->stack.size() - state.callTreeNodes);
+    callTree->contextDepth = state.previousContextDepth;
+  }
+#endif
+}
+
+// ==============================================================================================================================
+TraceDebugEvent TraceDebug::CreatePerformanceEvent(bool measureDone) {
+  // The results are known when the last trace point is added
+  TraceDebugTimings& timings = measureTimings[measureIndex];
+  TraceDebugEvent event = CreateEvent(TraceDebugEventKind::EndMeasure, true,
+                                      timings.empty() ? TraceDebugClock::Now() : timings.back().time);
+  event.callSite = &callSite;
+  // Get performance info of this call site
+  if(measureDone) {
+    event.timings = std::move(timings);
+  } else {
+    event.timings = timings;
+  }
+  return event;
+}
+
+// ==============================================================================================================================
+void TraceDebug::CacheOrPrintTimings(TraceDebugEvent&& output) {
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  if(overheadMeasure != nullptr) {
+    return;
+  }
+  // Not part of the measured cost of the macros: its duration is counted as it is done, printing the cache included
+  const TraceDebugClock::Ticks outputOverhead = threadOverhead;
+  const TraceDebugClock::Ticks outputStartTime = TraceDebugClock::Now();
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  RecordEvent(std::move(output));
+#elif defined(TRACE_DEBUG_LOCK_FREE)
+  // The writer thread does the caching and printing: this thread is not impacted
+  PushToThreadBuffer(std::move(output));
+#else
+  // Is the cache enabled ?
+  if(traceCacheDeepness > 1) {
+    localCache.push_back(std::move(output));
+    // Print all cache information when maximum cache size happened
+    if(localCache.size() >= traceCacheDeepness) {
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+      // Printing only hands the cache over to the writer thread: there is no overhead worth reporting
+      PrintCache();
+#else
+      auto startPrintingCacheTime = TraceDebugClock::Now();
+      PrintCache();
+      // Update all still existing trace points that their measures will be impacted because of the cache display
+      AddTimePoint(startPrintingCacheTime, "Start Printing cache");
+      auto endPrintingCacheTime = TraceDebugClock::Now();
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+      threadOverhead += endPrintingCacheTime - startPrintingCacheTime;
+#endif
+      AddTimePoint(endPrintingCacheTime, "Done Printing cache");
+      OutputEvent(CreatePerformanceEvent(false));
+      for(unsigned int index = 0; index < measureCount; ++index) {
+        for(auto& timing: measureTimings[index]) {
+          timing.printingOverhead += endPrintingCacheTime - startPrintingCacheTime;
+        }
+      }
+#endif
+    }
+  } else {
+    OutputEvent(std::move(output));
+  }
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  threadOverhead = outputOverhead + (TraceDebugClock::Now() - outputStartTime);
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::CacheOrPrintOutputs(TraceDebugEvent&& output) {
+  // If the cache is enabled, store output into cache
+  // If the cache reached its limit print it out
+  if(traceCacheDeepness > 1) {
+    localCache.push_back(std::move(output));
+    if(localCache.size() > traceCacheDeepness - 1) {
+      PrintCache();
+    }
+  } else {
+    // Display results without caching information
+    OutputEvent(std::move(output));
+  }
+
+}
+
+// ==============================================================================================================================
+void TraceDebug::OutputEvent(TraceDebugEvent&& output) {
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+  WriteAsync(std::move(output));
+#elif defined(TRACE_DEBUG_STRUCTURED_OUTPUT)
+  GET_OUTPUT_GUARD;
+  std::string serializedOutput;
+  AppendEvent(output, serializedOutput);
+  // We need the output immidiately
+  WriteBatch(serializedOutput, true);
+#else
+  PRINT_RESULT(FormatEvent(output));
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::AddTrace(TraceDebugClock::Ticks timePoint, const char* variableName) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  AddTimePoint(timePoint, variableName);
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  threadOverhead += overhead.checkpoint;
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::AddTrace(TraceDebugClock::Ticks timePoint, const std::string & variableName) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  AddTrace(timePoint, InternLabel(variableName));
+}
+
+// ==============================================================================================================================
+const char* TraceDebug::InternLabel(const std::string& label) {
+  // Leaked on purpose: the traces written when the program ends still point to the labels
+  static std::set<std::string>* labels = new std::set<std::string>();
+#ifdef ENABLE_THREAD_SAFE
+  static std::mutex labelsMutex;
+  std::lock_guard<std::mutex> lock(labelsMutex);
+#endif
+  return labels->insert(label).first->c_str();
+}
+
+// ==============================================================================================================================
+void TraceDebug::AddTimePoint(TraceDebugClock::Ticks timePoint, const char* variableName) {
+
+  GET_THREAD_SAFE_GUARD;
+  // Associate name of variable with time information
+  TraceDebugTiming timing;
+  timing.label = variableName;
+  timing.time = timePoint;
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  timing.overhead = threadOverhead;
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+  TraceDebugPerfCounters::Read(timing.counters);
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+  TraceDebugAllocationCounter::Read(timing.allocations);
+#endif
+  measureTimings[measureIndex].push_back(timing);
+
+}
+
+// ==============================================================================================================================
+void TraceDebug::ActiveTrace(bool activate) {
+  traceActive.store(activate, std::memory_order_relaxed);
+}
+
+// ==============================================================================================================================
+std::string TraceDebug::getSpaces(unsigned int deepness) {
+  if(deepness > 1) {
+    return std::string(2 * (deepness - 1), ' ');
+  }
+  return "";
+}
+
+// ==============================================================================================================================
+TraceDebugEvent TraceDebug::CreateEvent(TraceDebugEventKind kind, bool showHierarchy, TraceDebugClock::Ticks time) {
+  TraceDebugEvent event;
+  event.kind = kind;
+  event.deepness = showHierarchy ? GetDebugPrintDeepness() : 0;
+  event.threadId = std::this_thread::get_id();
+  event.time = time;
+  return event;
+}
+
+// ==============================================================================================================================
+void TraceDebug::PrintString(const std::string & inStr, bool showHierarchy) {
+  GET_THREAD_SAFE_GUARD;
+  TraceDebugEvent event = CreateEvent(TraceDebugEventKind::Text, showHierarchy);
+  event.text = inStr;
+  DispatchEvent(std::move(event));
+}
+
+// ==============================================================================================================================
+void TraceDebug::PrintEvent(TraceDebugEventKind kind, const TraceDebugCallSite& callSite, std::string && text) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  GET_THREAD_SAFE_GUARD;
+  TraceDebugEvent event = CreateEvent(kind, true);
+  event.callSite = &callSite;
+  event.text = std::move(text);
+  DispatchEvent(std::move(event));
+}
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+void TraceDebug::PrintEvent(TraceDebugEventKind kind, const TraceDebugCallSite& callSite, TraceDebugDeferredValue && value) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  GET_THREAD_SAFE_GUARD;
+  TraceDebugEvent event = CreateEvent(kind, true);
+  event.callSite = &callSite;
+  event.arguments = value.arguments;
+  event.text = value.GetText();
+  DispatchEvent(std::move(event));
+}
+
+// ==============================================================================================================================
+bool TraceDebugArguments::Append(Type type, const void* value, size_t valueSize) {
+  // Strings are preceded by their length
+  const size_t lengthSize = type == String ? sizeof(unsigned short) : 0;
+  if(size + 1 + lengthSize + valueSize > sizeof(data)) {
+    return false;
+  }
+  data[size++] = type;
+  if(type == String) {
+    const unsigned short length = static_cast<unsigned short>(valueSize);
+    std::memcpy(data + size, &length, sizeof(length));
+    size += sizeof(length);
+  }
+  std::memcpy(data + size, value, valueSize);
+  size += static_cast<unsigned short>(valueSize);
+  return true;
+}
+
+// ==============================================================================================================================
+void TraceDebugArguments::Format(std::ostream& stream) const {
+  for(size_t index = 0; index < size;) {
+    const Type type = static_cast<Type>(data[index++]);
+    switch(type) {
+      case Signed: {
+        long long value;
+        std::memcpy(&value, data + index, sizeof(value));
+        stream << value;
+        index += sizeof(value);
+        break;
+      }
+      case Unsigned: {
+        unsigned long long value;
+        std::memcpy(&value, data + index, sizeof(value));
+        stream << value;
+        index += sizeof(value);
+        break;
+      }
+      case FloatingPoint: {
+        double value;
+        std::memcpy(&value, data + index, sizeof(value));
+        stream << value;
+        index += sizeof(value);
+        break;
+      }
+      case Boolean: {
+        bool value;
+        std::memcpy(&value, data + index, sizeof(value));
+        stream << value;
+        index += sizeof(value);
+        break;
+      }
+      case Character:
+        stream << static_cast<char>(data[index++]);
+        break;
+      case String: {
+        unsigned short length;
+        std::memcpy(&length, data + index, sizeof(length));
+        index += sizeof(length);
+        stream.write(reinterpret_cast<const char*>(data + index), length);
+        index += length;
+        break;
+      }
+    }
+  }
+}
+#endif
+
+// ==============================================================================================================================
+void TraceDebug::DispatchEvent(TraceDebugEvent&& output) {
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  if(overheadMeasure != nullptr) {
+    return;
+  }
+  // Only the cost of the DISPLAY_* macros has been measured: their whole cost is counted with their last trace
+  switch(output.kind) {
+    case TraceDebugEventKind::Value:          threadOverhead += overhead.value; break;
+    case TraceDebugEventKind::ImmediateValue: threadOverhead += overhead.immediateValue; break;
+    case TraceDebugEventKind::Message:        threadOverhead += overhead.message; break;
+    default: break;
+  }
+  // Not part of the measured cost of the macros: its duration is counted as it is done
+  const TraceDebugClock::Ticks outputStartTime = TraceDebugClock::Now();
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  RecordEvent(std::move(output));
+#elif defined(TRACE_DEBUG_LOCK_FREE)
+  PushToThreadBuffer(std::move(output));
+#else
+  CacheOrPrintOutputs(std::move(output));
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  threadOverhead += TraceDebugClock::Now() - outputStartTime;
+#endif
+}
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+void TraceDebug::RecordEvent(TraceDebugEvent&& event) {
+  std::vector<TraceDebugEvent>& events = flightRecorder.events;
+  if(events.size() < TRACE_DEBUG_FLIGHT_RECORDER_SIZE) {
+    events.push_back(std::move(event));
+    return;
+  }
+  events[flightRecorder.next] = std::move(event);
+  flightRecorder.next = (flightRecorder.next + 1) % TRACE_DEBUG_FLIGHT_RECORDER_SIZE;
+}
+
+// ==============================================================================================================================
+bool TraceDebug::IsSlowCall(const TraceDebugCallSite& site, const TraceDebugTimings& timings) {
+  const TraceDebugClock::Ticks threshold = site.slowThreshold.load(std::memory_order_relaxed);
+  if(threshold == 0 || timings.size() < 2 || timings.back().time - timings.front().time < threshold) {
+    return false;
+  }
+  // At most one dump per interval and call site, shared by all threads: the other slow calls are only counted
+  const TraceDebugClock::Ticks now = timings.back().time;
+  long long nextDumpTime = site.nextDumpTime.load(std::memory_order_relaxed);
+  do {
+    if(now < nextDumpTime) {
+      site.undumpedSlowCalls.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } while(!site.nextDumpTime.compare_exchange_weak(nextDumpTime,
+            now + TraceDebugClock::FromNanoseconds(TRACE_DEBUG_FLIGHT_RECORDER_DUMP_INTERVAL_MS * 1000000LL),
+            std::memory_order_relaxed));
+  return true;
+}
+
+// ==============================================================================================================================
+void TraceDebug::DumpFlightRecorder(const TraceDebugCallSite& site, const TraceDebugTimings& timings) {
+  std::vector<TraceDebugEvent>& events = flightRecorder.events;
+  TraceDebugEvent header = CreateEvent(TraceDebugEventKind::Text, false, timings.back().time);
+  header.text = "Slow call " + std::string(site.fileName) + ":" + std::to_string(site.lineNumber) + " (" + site.functionName +
+                ") [" + site.label + "] lasted " + FormatDuration(timings.back().time - timings.front().time) +
+                " (threshold " + FormatDuration(site.slowThreshold.load(std::memory_order_relaxed)) + ")";
+  const unsigned long long undumpedSlowCalls = site.undumpedSlowCalls.exchange(0, std::memory_order_relaxed);
+  if(undumpedSlowCalls > 0) {
+    header.text += ", " + std::to_string(undumpedSlowCalls) + " slow calls not dumped since the previous dump";
+  }
+  header.text += ", last " + std::to_string(events.size()) + " traces of the thread:";
+  OutputEvent(std::move(header));
+  // Oldest first
+  for(size_t index = 0; index < events.size(); ++index) {
+    OutputEvent(std::move(events[(flightRecorder.next + index) % events.size()]));
+  }
+  // The next dump only displays the traces done after this one
+  events.clear();
+  flightRecorder.next = 0;
+}
+#endif
+
+// ==============================================================================================================================
+std::string TraceDebug::FormatEvent(const TraceDebugEvent& event) {
+  if(event.kind == TraceDebugEventKind::Text) {
+    return getSpaces(event.deepness) + event.text;
+  }
+  const TraceDebugCallSite& callSite = *event.callSite;
+  std::string tmp = getSpaces(event.deepness) + FormatTimeAndThreadId(event.time, event.threadId) + ":";
+  const std::string location = std::string(callSite.fileName) + ":" + std::to_string(callSite.lineNumber) + " (" + callSite.functionName + ")";
+  switch(event.kind) {
+    case TraceDebugEventKind::StartMeasure:
+      tmp += location + " [" + callSite.label + "]  Start measure";
+      break;
+    case TraceDebugEventKind::EndMeasure:
+      tmp += location + " [" + callSite.label + "]" + GetPerformanceResults(callSite, event.timings);
+      break;
+    case TraceDebugEventKind::ProcessingValue:
+      tmp += "Processing " + std::string(callSite.label) + "  From " + location;
+      break;
+    case TraceDebugEventKind::Value:
+      tmp += "->" + location + "  " + callSite.label + " = " + GetEventText(event);
+      break;
+    case TraceDebugEventKind::ImmediateValue:
+      tmp += location + "  " + callSite.label + " = " + GetEventText(event);
+      break;
+    case TraceDebugEventKind::Message:
+    default:
+      tmp += location + "  " + GetEventText(event);
+      break;
+  }
+  return tmp;
+}
+
+// ==============================================================================================================================
+std::string TraceDebug::GetEventText(const TraceDebugEvent& event) {
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+  if(event.arguments.size > 0) {
+    std::ostringstream stream;
+    event.arguments.Format(stream);
+    return stream.str() + event.text;
+  }
+#endif
+  return event.text;
+}
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+namespace {
+  // " [allocations 12, bytes 3456]", empty for traced locks and tasks which do not count them
+  std::string FormatAllocations(const TraceDebugCallSite& callSite, const TraceDebugAllocations& from,
+                                const TraceDebugAllocations& to) {
+    if(callSite.kind != TraceDebugCallSiteKind::Trace) {
+      return std::string();
+    }
+    return " [allocations " + std::to_string(to.count - from.count) + ", bytes " + std::to_string(to.bytes - from.bytes) + "]";
+  }
+}
+#endif
+
+// ==============================================================================================================================
+std::string TraceDebug::GetPerformanceResults(const TraceDebugCallSite& callSite, const TraceDebugTimings& performanceInfos) {
+  std::string tmp;
+#ifndef TRACE_DEBUG_COUNT_ALLOCATIONS
+  (void)callSite;
+#endif
+
+  // If the number of information stored is greater than 1 a difference can be computed
+  if(performanceInfos.size() > 1) {
+    auto size = performanceInfos.size() - 1;
+    // Compute all timing differences
+    for(decltype(size) index = 0; index < size; ++index)
+    {
+      const auto& valueMin = performanceInfos[index];
+      const auto& valueMax = performanceInfos[index + 1];
+      tmp += ", <" + FormatLabel(valueMax) + "> - <" + FormatLabel(valueMin) + "> = "
+             + FormatDuration(valueMin, valueMax);
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+      tmp += FormatCounters(valueMin.counters, valueMax.counters);
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+      tmp += FormatAllocations(callSite, valueMin.allocations, valueMax.allocations);
+#endif
+    }
+    if(size > 1)
+    {
+      const auto& valueMin = performanceInfos[0];
+      const auto& valueMax = performanceInfos[size];
+      tmp += ", Full time: "
+             + FormatDuration(valueMin, valueMax);
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+      tmp += FormatCounters(valueMin.counters, valueMax.counters);
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+      tmp += FormatAllocations(callSite, valueMin.allocations, valueMax.allocations);
+#endif
+    }
+  }
+  else
+  {
+    // We have 1 timing information only, no difference can be computed
+    tmp += ": Not enough trace to display results.";
+  }
+  return tmp;
+}
+
+// ==============================================================================================================================
+void TraceDebug::SetTracePerformanceCacheDeepness(unsigned int cacheDeepness)
+{
+  GET_OUTPUT_GUARD;
+  if (cacheDeepness != traceCacheDeepness)
+  {
+    traceCacheDeepness = cacheDeepness;
+    // Set a little bigger as the time for displaying output will
+    // automatically be added.
+    localCache.reserve(traceCacheDeepness + 3);
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::Finalize()
+{
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  // This method is called by a guard statically created that will
+  // automatically expire when the program expires.
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+  StopWriterThread();
+#endif
+#ifdef TRACE_DEBUG_LOCK_FREE
+  DrainThreadBuffers();
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+  StopTimeSeriesThread();
+#endif
+  GET_OUTPUT_GUARD;
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+  OutputStatistics();
+#else
+  OutputSkippedCalls(std::vector<bool>());
+#endif
+  OutputCounters();
+#ifdef TRACE_DEBUG_CALL_TREE
+  OutputCallTree(TRACE_DEBUG_CALL_TREE_TOP);
+#endif
+  TraceDebug::PrintCache();
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+  std::vector<TraceDebugEvent> events;
+  {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    events.swap(pendingOutputs);
+    // Traces done after Finalize start a new writer thread
+    writerStopRequested = false;
+  }
+  std::string batch;
+  for (const TraceDebugEvent& event : events)
+  {
+    AppendEvent(event, batch);
+  }
+#ifdef TRACE_DEBUG_CHROME_TRACE
+  AppendChromeCounters(batch);
+#endif
+  WriteBatch(batch, true);
+#endif
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+  mappedFile.Close();
+#endif
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+  // The last segment is archived as the others, the program waits for it
+  CloseOutputSegment();
+  StopArchiveThread();
+#elif defined(WRITE_OUTPUT_TO_FILE)
+  if (outputFile.is_open())
+  {
+#ifdef TRACE_DEBUG_CHROME_TRACE
+    outputFile << "\n]\n";
+#endif
+    outputFile.close();
+  }
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::FinalizeAtExit()
+{
+  // A single guard: the statistics, call tree and counters are displayed once
+  static Guard guardOnLeavingProgram;
+}
+
+// ==============================================================================================================================
+std::string TraceDebug::GetDiffTimeSinceStartAndThreadId()
+{
+  std::chrono::duration <double, UNIT_TRACE_TEMPLATE_TYPE> elapsedTime =
+          std::chrono::nanoseconds(TraceDebugClock::ToEpochNanoseconds(TraceDebugClock::Now()));
+  std::string returnValue =
+          std::to_string(elapsedTime.count()) + UNIT_TRACE_DEBUG;
+#ifdef ENABLE_THREAD_SAFE
+  std::ostringstream buffer;
+  buffer << std::this_thread::get_id();
+  returnValue += ":" + buffer.str();
+#endif
+  return returnValue;
+}
+
+// ==============================================================================================================================
+std::string TraceDebug::FormatTimeAndThreadId(TraceDebugClock::Ticks time, std::thread::id threadId)
+{
+  std::chrono::duration <double, UNIT_TRACE_TEMPLATE_TYPE> elapsedTime =
+          std::chrono::nanoseconds(TraceDebugClock::ToEpochNanoseconds(time));
+  std::string returnValue =
+          std::to_string(elapsedTime.count()) + UNIT_TRACE_DEBUG;
+#ifdef ENABLE_THREAD_SAFE
+  returnValue += ":" + FormatThreadId(threadId);
+#else
+  (void)threadId;
+#endif
+  return returnValue;
+}
+
+// ==============================================================================================================================
+std::string TraceDebug::FormatDuration(TraceDebugClock::Ticks ticks)
+{
+  return std::to_string(std::chrono::duration<double, UNIT_TRACE_TEMPLATE_TYPE>(
+                                std::chrono::nanoseconds(TraceDebugClock::ToNanoseconds(ticks))).count()) + UNIT_TRACE_DEBUG;
+}
+
+// ==============================================================================================================================
+std::string TraceDebug::FormatDuration(const TraceDebugTiming& from, const TraceDebugTiming& to)
+{
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  return FormatDuration(to.time - from.time) + " (" + FormatDuration(GetCorrectedDuration(from, to)) + " without traces)";
+#else
+  return FormatDuration(to.time - from.time);
+#endif
+}
+
+// ==============================================================================================================================
+std::string TraceDebug::FormatLabel(const TraceDebugTiming& timing)
+{
+#ifndef TRACE_DEBUG_ASYNC_WRITER
+  if (timing.printingOverhead != 0)
+    return "(***!!! Printing inducted " + FormatDuration(timing.printingOverhead) + " overhead in this measure !!!***)" +
+           timing.label;
+#endif
+  return timing.label;
+}
+
+// ==============================================================================================================================
+const std::string& TraceDebug::FormatThreadId(std::thread::id threadId)
+{
+  // Only called where traces are written
+  auto threadIdTextIt = threadIdTexts.find(threadId);
+  if (threadIdTextIt == threadIdTexts.end())
+  {
+    std::ostringstream buffer;
+    buffer << threadId;
+    threadIdTextIt = threadIdTexts.emplace(threadId, buffer.str()).first;
+  }
+  return threadIdTextIt->second;
+}
+
+// ==============================================================================================================================
+void TraceDebug::DisplayStartTracePerformance(
+        bool inDisplayStartTracePerformance)
+{
+  GET_THREAD_SAFE_GUARD;
+  displayStartTracePerformance = inDisplayStartTracePerformance;
+}
+
+// ==============================================================================================================================
+void TraceDebug::SetOutputFlushInterval(unsigned int flushIntervalMs)
+{
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+  outputFlushIntervalMs = flushIntervalMs;
+#else
+  (void)flushIntervalMs;
+#endif
+}
+
+// ==============================================================================================================================
+unsigned long long TraceDebug::GetDroppedTraceCount()
+{
+  return droppedTraces;
+}
+
+// ==============================================================================================================================
+void TraceDebug::PrintStatistics()
+{
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  GET_OUTPUT_GUARD;
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+  OutputStatistics();
+#else
+  OutputSkippedCalls(std::vector<bool>());
+#endif
+  OutputCounters();
+}
+
+// ==============================================================================================================================
+TraceDebugCounter::TraceDebugCounter(const std::string& name, bool gauge): name(name), gauge(gauge)
+{
+  for (Shard& shard : shards)
+  {
+    shard.value.store(0, std::memory_order_relaxed);
+  }
+}
+
+// ==============================================================================================================================
+long long TraceDebugCounter::Read() const
+{
+  long long sum = 0;
+  for (const Shard& shard : shards)
+  {
+    sum += shard.value.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+// ==============================================================================================================================
+TraceDebugCounter& TraceDebug::GetCounter(const std::string& name, bool gauge)
+{
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  // Only called once per macro expansion
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(countersMutex);
+#endif
+  for (TraceDebugCounter& counter : counters)
+  {
+    if (counter.name == name)
+      return counter;
+  }
+  counters.emplace_back(name, gauge);
+  return counters.back();
+}
+
+// ==============================================================================================================================
+std::vector<std::pair<const TraceDebugCounter*, long long>> TraceDebug::ReadCounters()
+{
+  std::vector<std::pair<const TraceDebugCounter*, long long>> values;
+#ifdef ENABLE_THREAD_SAFE
+  std::lock_guard<std::mutex> lock(countersMutex);
+#endif
+  for (const TraceDebugCounter& counter : counters)
+  {
+    values.emplace_back(&counter, counter.Read());
+  }
+  return values;
+}
+
+// ==============================================================================================================================
+void TraceDebug::OutputCounters()
+{
+  const std::vector<std::pair<const TraceDebugCounter*, long long>> values = ReadCounters();
+  for (const auto& value : values)
+  {
+    TraceDebugEvent event = CreateEvent(TraceDebugEventKind::Text, false);
+    event.text = std::string(value.first->gauge ? "Gauge " : "Counter ") + value.first->name + ": " + std::to_string(value.second);
+    CacheOrPrintOutputs(std::move(event));
+  }
+#if defined(TRACE_DEBUG_CHROME_TRACE) && !defined(TRACE_DEBUG_ASYNC_WRITER)
+  // Without writer thread the counter tracks only get a point when the counters are displayed
+  std::string batch;
+  AppendChromeCounters(batch);
+  WriteBatch(batch, false);
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::PrintCache()
+{
+  if (localCache.size() > 0)
+  {
+    for (TraceDebugEvent& event : localCache)
+    {
+      OutputEvent(std::move(event));
+    }
+    localCache.clear();
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::IncreaseDebugPrintDeepness()
+{
+  ++debugPrintDeepness;
+#ifdef TRACE_DEBUG_USE_GLOBAL_MUTEX
+  allDebugPrintDeepness.fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::DecreaseDebugPrintDeepness()
+{
+  --debugPrintDeepness;
+#ifdef TRACE_DEBUG_USE_GLOBAL_MUTEX
+  allDebugPrintDeepness.fetch_sub(1, std::memory_order_relaxed);
+#endif
+}
+
+// ==============================================================================================================================
+unsigned int TraceDebug::GetDebugPrintDeepness()
+{
+  return debugPrintDeepness;
+}
+
+// ==============================================================================================================================
+unsigned int TraceDebug::GetAllDebugPrintDeepness()
+{
+#ifdef TRACE_DEBUG_USE_GLOBAL_MUTEX
+  return allDebugPrintDeepness.load(std::memory_order_relaxed);
+#else
+  // The hierarchy bookkeeping belongs to this thread
+  return GetDebugPrintDeepness();
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::AppendEvent(const TraceDebugEvent& event, std::string& output)
+{
+#ifdef TRACE_DEBUG_STRUCTURED_OUTPUT
+  // Opening the file starts a new set of definitions (threads, call sites ...): it must be done first
+  OpenOutputFile(TRACE_DEBUG_OUTPUT_FILE_NAME);
+#endif
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+  AppendBinaryEvent(event, output);
+#elif defined(TRACE_DEBUG_CHROME_TRACE)
+  AppendChromeTraceEvent(event, output);
+#else
+  output += FormatEvent(event);
+  output += '\n';
+#endif
+}
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+namespace {
+  template <typename T>
+  void AppendBinary(std::string& output, const T& value)
+  {
+    output.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void AppendBinaryRecord(std::string& output, TraceDebugBinaryKind kind, uint32_t callSiteId, uint32_t threadIndex,
+                          int64_t time, unsigned int deepness, uint16_t checkpointCount, const std::string& payload)
+  {
+    TraceDebugBinaryRecord record;
+    record.callSiteId = callSiteId;
+    record.threadIndex = threadIndex;
+    record.time = time;
+    record.kind = kind;
+    record.deepness = static_cast<uint8_t>(deepness > 255 ? 255 : deepness);
+    record.checkpointCount = checkpointCount;
+    record.payloadSize = static_cast<uint32_t>(payload.size());
+    AppendBinary(output, record);
+    output += payload;
+  }
+}
+
+void TraceDebug::AppendBinaryEvent(const TraceDebugEvent& event, std::string& output)
+{
+  // Threads, call sites and labels are written once, records only reference them
+  auto threadIt = binaryThreadIndexes.find(event.threadId);
+  if (threadIt == binaryThreadIndexes.end())
+  {
+    threadIt = binaryThreadIndexes.emplace(event.threadId, static_cast<unsigned int>(binaryThreadIndexes.size())).first;
+    AppendBinaryRecord(output, TRACE_DEBUG_BINARY_THREAD, 0, threadIt->second, 0, 0, 0, FormatThreadId(event.threadId));
+  }
+  uint32_t callSiteId = 0;
+  if (event.callSite != nullptr)
+  {
+    callSiteId = event.callSite->id;
+    if (binaryCallSitesWritten.size() <= callSiteId)
+    {
+      binaryCallSitesWritten.resize(callSiteId + 1, false);
+    }
+    if (!binaryCallSitesWritten[callSiteId])
+    {
+      binaryCallSitesWritten[callSiteId] = true;
+      std::string callSite;
+      AppendBinary(callSite, static_cast<int32_t>(event.callSite->lineNumber));
+      callSite += event.callSite->fileName;
+      callSite += '\0';
+      callSite += event.callSite->functionName;
+      callSite += '\0';
+      callSite += event.callSite->label;
+      callSite += '\0';
+      AppendBinaryRecord(output, TRACE_DEBUG_BINARY_CALL_SITE, callSiteId, 0, 0, 0, 0, callSite);
+    }
+  }
+
+  const int64_t time = TraceDebugClock::ToEpochNanoseconds(event.time);
+  std::string payload;
+  TraceDebugBinaryKind kind = TRACE_DEBUG_BINARY_TEXT;
+  switch (event.kind)
+  {
+    case TraceDebugEventKind::Text:            kind = TRACE_DEBUG_BINARY_TEXT; payload = event.text; break;
+    case TraceDebugEventKind::StartMeasure:    kind = TRACE_DEBUG_BINARY_START_MEASURE; break;
+    case TraceDebugEventKind::ProcessingValue: kind = TRACE_DEBUG_BINARY_PROCESSING_VALUE; break;
+    case TraceDebugEventKind::Value:           kind = TRACE_DEBUG_BINARY_VALUE; payload = GetEventText(event); break;
+    case TraceDebugEventKind::ImmediateValue:  kind = TRACE_DEBUG_BINARY_IMMEDIATE_VALUE; payload = GetEventText(event); break;
+    case TraceDebugEventKind::Message:         kind = TRACE_DEBUG_BINARY_MESSAGE; payload = GetEventText(event); break;
+    case TraceDebugEventKind::EndMeasure:
+      kind = TRACE_DEBUG_BINARY_END_MEASURE;
+      for (const auto& timing : event.timings)
+      {
+        auto labelIt = binaryLabelIds.find(timing.label);
+        if (labelIt == binaryLabelIds.end())
+        {
+          labelIt = binaryLabelIds.emplace(timing.label, static_cast<unsigned int>(binaryLabelIds.size())).first;
+          AppendBinaryRecord(output, TRACE_DEBUG_BINARY_LABEL, labelIt->second, 0, 0, 0, 0, timing.label);
+        }
+        TraceDebugBinaryCheckpoint checkpoint;
+        checkpoint.labelId = labelIt->second;
+        checkpoint.reserved = 0;
+        checkpoint.ticks = TraceDebugClock::ToEpochNanoseconds(timing.time);
+        AppendBinary(payload, checkpoint);
+      }
+      break;
+  }
+  const size_t checkpointCount = event.kind == TraceDebugEventKind::EndMeasure ? event.timings.size() : 0;
+  AppendBinaryRecord(output, kind, callSiteId, threadIt->second, time, event.deepness,
+                     static_cast<uint16_t>(checkpointCount > 0xFFFF ? 0xFFFF : checkpointCount),
+                     checkpointCount > 0xFFFF ? payload.substr(0, 0xFFFF * sizeof(TraceDebugBinaryCheckpoint)) : payload);
+}
+#endif
+
+// ==============================================================================================================================
+#if defined(TRACE_DEBUG_CHROME_TRACE) || defined(TRACE_DEBUG_TIME_SERIES)
+namespace {
+  void AppendJsonString(std::string& output, const std::string& text)
+  {
+    output += '"';
+    for (char character : text)
+    {
+      switch (character)
+      {
+        case '"':  output += "\\\""; break;
+        case '\\': output += "\\\\"; break;
+        case '\n': output += "\\n"; break;
+        case '\r': output += "\\r"; break;
+        case '\t': output += "\\t"; break;
+        default:
+          if (static_cast<unsigned char>(character) < 0x20)
+          {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(character));
+            output += escaped;
+          }
+          else
+          {
+            output += character;
+          }
+      }
+    }
+    output += '"';
+  }
+}
+#endif
+
+#ifdef TRACE_DEBUG_CHROME_TRACE
+namespace {
+  // Chrome traces are in micro seconds
+  void AppendMicroseconds(std::string& output, long long nanoseconds)
+  {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%lld.%03lld", nanoseconds / 1000, std::llabs(nanoseconds % 1000));
+    output += buffer;
+  }
+}
+
+void TraceDebug::AppendChromeTraceEvent(const TraceDebugEvent& event, std::string& output)
+{
+  const std::string pid = std::to_string(GETPID);
+  // Events are separated by commas: the file stays valid when the last ] is missing
+  auto beginEvent = [&output]() {
+    output += chromeTraceEventCount++ == 0 ? "\n{" : ",\n{";
+  };
+
+  // Threads are named when they are first seen
+  auto getTid = [&output, &pid, &beginEvent](std::thread::id threadId) {
+    auto threadIt = chromeTraceThreadIds.find(threadId);
+    if (threadIt == chromeTraceThreadIds.end())
+    {
+      threadIt = chromeTraceThreadIds.emplace(threadId, static_cast<unsigned int>(chromeTraceThreadIds.size() + 1)).first;
+      beginEvent();
+      output += "\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid + ",\"tid\":" + std::to_string(threadIt->second) +
+                ",\"args\":{\"name\":";
+      AppendJsonString(output, "Thread " + FormatThreadId(threadId));
+      output += "}}";
+    }
+    return std::to_string(threadIt->second);
+  };
+  const std::string tid = getTid(event.threadId);
+  const long long time = TraceDebugClock::ToEpochNanoseconds(event.time);
+  const TraceDebugCallSite* callSite = event.callSite;
+  auto appendLocation = [&output, callSite]() {
+    output += "\"file\":";
+    AppendJsonString(output, callSite->fileName);
+    output += ",\"line\":" + std::to_string(callSite->lineNumber) + ",\"function\":";
+    AppendJsonString(output, callSite->functionName);
+  };
+
+  switch (event.kind)
+  {
+    case TraceDebugEventKind::EndMeasure:
+    {
+      // A complete event for the scope, an instant event for each ADD_TRACE_PERFORMANCE
+      const TraceDebugTimings& timings = event.timings;
+      if (timings.size() < 2)
+        return;
+      if (callSite->kind == TraceDebugCallSiteKind::Task)
+      {
+        // A flow from the scope which submitted the task to the first scope of the task, and the wait as an instant event
+        const std::string id = std::to_string(event.contextId);
+        const std::string submitTid = getTid(event.contextThreadId);
+        beginEvent();
+        output += "\"ph\":\"s\",\"cat\":\"task\",\"name\":";
+        AppendJsonString(output, callSite->label);
+        output += ",\"id\":" + id + ",\"pid\":" + pid + ",\"tid\":" + submitTid + ",\"ts\":";
+        AppendMicroseconds(output, TraceDebugClock::ToEpochNanoseconds(timings.front().time));
+        output += '}';
+        beginEvent();
+        output += "\"ph\":\"f\",\"cat\":\"task\",\"name\":";
+        AppendJsonString(output, callSite->label);
+        output += ",\"id\":" + id + ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"ts\":";
+        AppendMicroseconds(output, time);
+        output += '}';
+        beginEvent();
+        output += "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"task\",\"name\":";
+        AppendJsonString(output, callSite->label);
+        output += ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"ts\":";
+        AppendMicroseconds(output, time);
+        output += ",\"args\":{";
+        appendLocation();
+        output += ",\"<Started> - <Submitted>\":";
+        AppendMicroseconds(output, TraceDebugClock::ToNanoseconds(timings.back().time - timings.front().time));
+        output += "}}";
+        return;
+      }
+      const long long startTime = TraceDebugClock::ToEpochNanoseconds(timings.front().time);
+      beginEvent();
+      output += "\"ph\":\"X\",\"cat\":\"performance\",\"name\":";
+      AppendJsonString(output, callSite->label);
+      output += ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"ts\":";
+      AppendMicroseconds(output, startTime);
+      output += ",\"dur\":";
+      AppendMicroseconds(output, TraceDebugClock::ToNanoseconds(timings.back().time - timings.front().time));
+      output += ",\"args\":{";
+      appendLocation();
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+      for (unsigned int counter = 0; counter < TraceDebugCounters::count && TraceDebugPerfCounters::GetName(0) != nullptr;
+           ++counter)
+      {
+        output += ',';
+        AppendJsonString(output, TraceDebugPerfCounters::GetName(counter));
+        output += ':' + std::to_string(timings.back().counters.values[counter] - timings.front().counters.values[counter]);
+      }
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+      if (callSite->kind == TraceDebugCallSiteKind::Trace)
+      {
+        output += ",\"allocations\":" + std::to_string(timings.back().allocations.count - timings.front().allocations.count) +
+                  ",\"allocated bytes\":" + std::to_string(timings.back().allocations.bytes - timings.front().allocations.bytes);
+      }
+#endif
+      for (size_t index = 0; index + 1 < timings.size(); ++index)
+      {
+        output += ',';
+        AppendJsonString(output, std::string("<") + timings[index + 1].label + "> - <" + timings[index].label + ">");
+        output += ':';
+        AppendMicroseconds(output, TraceDebugClock::ToNanoseconds(timings[index + 1].time - timings[index].time));
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+        output += ',';
+        AppendJsonString(output, std::string("<") + timings[index + 1].label + "> - <" + timings[index].label + "> without traces");
+        output += ':';
+        AppendMicroseconds(output, TraceDebugClock::ToNanoseconds(GetCorrectedDuration(timings[index], timings[index + 1])));
+#endif
+      }
+      output += "}}";
+      for (size_t index = 1; index + 1 < timings.size(); ++index)
+      {
+        beginEvent();
+        output += "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"performance\",\"name\":";
+        AppendJsonString(output, timings[index].label);
+        output += ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"ts\":";
+        AppendMicroseconds(output, TraceDebugClock::ToEpochNanoseconds(timings[index].time));
+        output += '}';
+      }
+      return;
+    }
+    case TraceDebugEventKind::StartMeasure:
+    case TraceDebugEventKind::ProcessingValue:
+      // Part of the complete event of the scope
+      return;
+    default:
+      break;
+  }
+
+  beginEvent();
+  output += "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"debug\",\"name\":";
+  if (callSite == nullptr)
+  {
+    AppendJsonString(output, event.text);
+  }
+  else if (event.kind == TraceDebugEventKind::Message)
+  {
+    AppendJsonString(output, GetEventText(event));
+  }
+  else
+  {
+    AppendJsonString(output, std::string(callSite->label) + " = " + GetEventText(event));
+  }
+  output += ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"ts\":";
+  AppendMicroseconds(output, time);
+  if (callSite != nullptr)
+  {
+    output += ",\"args\":{";
+    appendLocation();
+    output += '}';
+  }
+  output += '}';
+}
+
+// ==============================================================================================================================
+void TraceDebug::AppendChromeCounters(std::string& output)
+{
+  const std::vector<std::pair<const TraceDebugCounter*, long long>> values = ReadCounters();
+  if (values.empty())
+    return;
+  OpenOutputFile(TRACE_DEBUG_OUTPUT_FILE_NAME);
+  const std::string pid = std::to_string(GETPID);
+  const long long time = TraceDebugClock::ToEpochNanoseconds(TraceDebugClock::Now());
+  for (const auto& value : values)
+  {
+    output += chromeTraceEventCount++ == 0 ? "\n{" : ",\n{";
+    output += "\"ph\":\"C\",\"name\":";
+    AppendJsonString(output, value.first->name);
+    output += ",\"pid\":" + pid + ",\"ts\":";
+    AppendMicroseconds(output, time);
+    output += ",\"args\":{\"value\":" + std::to_string(value.second) + "}}";
+  }
+}
+#endif
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_TIME_SERIES
+namespace {
+  void AppendCsvString(std::string& output, const std::string& text)
+  {
+    output += '"';
+    for (char character : text)
+    {
+      if (character == '"')
+        output += '"';
+      output += character;
+    }
+    output += '"';
+  }
+
+  // Times of the time series are in ms with a ns precision
+  void AppendMilliseconds(std::string& output, long long nanoseconds)
+  {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%lld.%06lld", nanoseconds / 1000000, nanoseconds % 1000000);
+    output += buffer;
+  }
+}
+
+void TraceDebug::StartTimeSeries(const std::string& fileName, unsigned int intervalMs)
+{
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  // The previous file gets its last interval
+  StopTimeSeriesThread();
+  if (intervalMs == 0)
+    return;
+  std::lock_guard<std::mutex> lock(timeSeriesMutex);
+  if (timeSeriesThread.joinable())
+    return;
+  // Stop the thread and write the last interval when the program ends
+  FinalizeAtExit();
+  timeSeriesFile.open(fileName, std::ofstream::out | std::ofstream::trunc);
+  if (!timeSeriesFile.is_open())
+  {
+    std::cerr << "TraceDebug: cannot open " << fileName << std::endl;
+    return;
+  }
+  const std::string jsonExtension = ".jsonl";
+  timeSeriesJson = fileName.size() >= jsonExtension.size() &&
+                   fileName.compare(fileName.size() - jsonExtension.size(), jsonExtension.size(), jsonExtension) == 0;
+  if (!timeSeriesJson)
+  {
+    timeSeriesFile << "time_ms,interval_ms,file,line,function,label,segment,count,mean_ns,p50_ns,p99_ns,max_ns\n";
+  }
+  // The first interval starts now: the measures done before are not part of it
+  TraceDebugStatisticsShard measuresBefore;
+  TakeWindowStatistics(measuresBefore);
+  timeSeriesWindowStart = TraceDebugClock::Now();
+  timeSeriesIntervalMs = intervalMs;
+  timeSeriesStopRequested = false;
+  timeSeriesThread = std::thread(&TraceDebug::WriteTimeSeries);
+}
+
+// ==============================================================================================================================
+void TraceDebug::StopTimeSeriesThread()
+{
+  std::thread sampler;
+  {
+    std::lock_guard<std::mutex> lock(timeSeriesMutex);
+    timeSeriesStopRequested = true;
+    sampler = std::move(timeSeriesThread);
+  }
+  timeSeriesCondition.notify_all();
+  if (sampler.joinable())
+  {
+    sampler.join();
+    WriteTimeSeriesWindow();
+    timeSeriesFile.close();
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::WriteTimeSeries()
+{
+  // Intervals do not drift with the time spent writing them
+  auto windowEnd = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(timeSeriesMutex);
+  while (true)
+  {
+    windowEnd += std::chrono::milliseconds(timeSeriesIntervalMs);
+    if (timeSeriesCondition.wait_until(lock, windowEnd, []() { return timeSeriesStopRequested; }))
+      return;
+    lock.unlock();
+    WriteTimeSeriesWindow();
+    lock.lock();
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::TakeWindowStatistics(TraceDebugStatisticsShard& result)
+{
+  auto take = [&result](TraceDebugStatisticsShard& shard) {
+    if (result.callSites.size() < shard.callSites.size())
+    {
+      result.callSites.resize(shard.callSites.size());
+    }
+    for (size_t id = 0; id < shard.callSites.size(); ++id)
+    {
+      auto& segments = shard.callSites[id];
+      for (size_t index = 0; index < segments.size(); ++index)
+      {
+        GetSegmentStatistics(result.callSites[id], index, segments[index].fromLabel.c_str(), segments[index].toLabel.c_str())
+                .windowHistogram.Merge(segments[index].windowHistogram);
+        segments[index].windowHistogram = TraceDebugHistogram();
+      }
+    }
+  };
+  std::lock_guard<std::mutex> lock(statisticsShardsMutex);
+  for (const std::shared_ptr<TraceDebugStatisticsShard>& shard : statisticsShards)
+  {
+#ifdef ENABLE_THREAD_SAFE
+    std::lock_guard<std::mutex> shardLock(shard->mutex);
+#endif
+    take(*shard);
+  }
+  // Threads that exited since the last interval, merged by OutputStatistics
+  take(exitedThreadsStatistics);
+}
+
+// ==============================================================================================================================
+void TraceDebug::WriteTimeSeriesWindow()
+{
+  TraceDebugStatisticsShard window;
+  TakeWindowStatistics(window);
+  const TraceDebugClock::Ticks now = TraceDebugClock::Now();
+  const long long interval = TraceDebugClock::ToNanoseconds(now - timeSeriesWindowStart);
+  timeSeriesWindowStart = now;
+  std::vector<const TraceDebugCallSite*> registeredCallSites;
+  {
+#ifdef ENABLE_THREAD_SAFE
+    std::lock_guard<std::mutex> lock(callSitesMutex);
+#endif
+    registeredCallSites = callSites;
+  }
+  std::string time;
+  AppendMilliseconds(time, TraceDebugClock::ToEpochNanoseconds(now));
+  std::string intervalText;
+  AppendMilliseconds(intervalText, interval);
+  std::string record;
+  if (timeSeriesJson)
+  {
+    record = "{\"time_ms\":" + time + ",\"interval_ms\":" + intervalText + ",\"segments\":[";
+  }
+  bool first = true;
+  for (size_t id = 0; id < window.callSites.size(); ++id)
+  {
+    const TraceDebugCallSite& site = *registeredCallSites[id];
+    for (const TraceDebugSegmentStatistics& segment : window.callSites[id])
+    {
+      const TraceDebugHistogram& histogram = segment.windowHistogram;
+      if (histogram.GetCount() == 0)
+        continue;
+      const std::string segmentName =
+              segment.fromLabel.empty() ? segment.toLabel : "<" + segment.toLabel + "> - <" + segment.fromLabel + ">";
+      const std::string values = std::to_string(histogram.GetCount()) + (timeSeriesJson ? ",\"mean_ns\":" : ",") +
+                                 std::to_string(std::llround(histogram.GetMean())) + (timeSeriesJson ? ",\"p50_ns\":" : ",") +
+                                 std::to_string(histogram.GetPercentile(0.5)) + (timeSeriesJson ? ",\"p99_ns\":" : ",") +
+                                 std::to_string(histogram.GetPercentile(0.99)) + (timeSeriesJson ? ",\"max_ns\":" : ",") +
+                                 std::to_string(histogram.GetMax());
+      if (timeSeriesJson)
+      {
+        record += first ? "{\"file\":" : ",{\"file\":";
+        AppendJsonString(record, site.fileName);
+        record += ",\"line\":" + std::to_string(site.lineNumber) + ",\"function\":";
+        AppendJsonString(record, site.functionName);
+        record += ",\"label\":";
+        AppendJsonString(record, site.label);
+        record += ",\"segment\":";
+        AppendJsonString(record, segmentName);
+        record += ",\"count\":" + values + "}";
+      }
+      else
+      {
+        record += time + "," + intervalText + ",";
+        AppendCsvString(record, site.fileName);
+        record += "," + std::to_string(site.lineNumber) + ",";
+        AppendCsvString(record, site.functionName);
+        record += ",";
+        AppendCsvString(record, site.label);
+        record += ",";
+        AppendCsvString(record, segmentName);
+        record += "," + values + "\n";
+      }
+      first = false;
+    }
+  }
+  if (timeSeriesJson)
+  {
+    // Intervals without measures are written too: they show when the program was idle
+    record += "]}\n";
+  }
+  timeSeriesFile.write(record.data(), record.size());
+  timeSeriesFile.flush();
+}
+#endif
+
+// ==============================================================================================================================
+#ifdef WRITE_OUTPUT_TO_FILE
+void TraceDebug::WriteToFile(const std::string& stringToWrite,
+                             const std::string& fileName)
+{
+  GET_OUTPUT_GUARD;
+  OpenOutputFile(fileName);
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+  // Written pages survive a crash of the program without flushing
+  mappedFile.Write(stringToWrite.data(), stringToWrite.size());
+  mappedFile.Write("\n", 1);
+#else
+  outputFile << stringToWrite << "\n";
+  // We need the output immidiately
+  outputFile.flush();
+#endif
+}
+
+// ==============================================================================================================================
+void TraceDebug::OpenOutputFile(const std::string& fileName)
+{
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+  if (!mappedFile.IsOpen())
+#else
+  if (!outputFile.is_open())
+#endif
+  {
+    // Close the file when the program ends
+    FinalizeAtExit();
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+    const std::string extension = ".bin";
+#elif defined(TRACE_DEBUG_CHROME_TRACE)
+    const std::string extension = ".json";
+#elif defined(TRACE_DEBUG_MAPPED_OUTPUT)
+    const std::string extension = ".mmap";
+#else
+    const std::string extension = ".log";
+#endif
+    // Search for a non existing filename
+    std::string tmpFileName = fileName + "-" + std::to_string(GETPID);
+    struct stat buffer;
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+    // Only the first segment searches a free name: the next ones increase its number
+    if (outputSegmentBaseName.empty())
+    {
+      for (int index = 0; stat((tmpFileName + ".1" + extension).c_str(), &buffer) == 0; ++index)
+      {
+        tmpFileName = fileName + "-" + std::to_string(GETPID) + "-" + std::to_string(index);
+      }
+      outputSegmentBaseName = tmpFileName;
+    }
+    tmpFileName = outputSegmentBaseName + "." + std::to_string(++outputSegmentNumber);
+    outputSegmentSize = 0;
+    outputSegmentOpenTime = std::chrono::steady_clock::now();
+#else
+    for (int index = 0; stat((tmpFileName + extension).c_str(), &buffer) == 0; ++index)
+    {
+      tmpFileName = fileName + "-" + std::to_string(GETPID) + "-" + std::to_string(index);
+    }
+#endif
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+    outputFile.open(tmpFileName + extension, std::ofstream::out | std::ofstream::binary);
+    TraceDebugBinaryHeader header;
+    std::memcpy(header.magic, TRACE_DEBUG_BINARY_MAGIC, sizeof(header.magic));
+    header.byteOrderMark = TRACE_DEBUG_BINARY_BYTE_ORDER_MARK;
+    header.version = TRACE_DEBUG_BINARY_VERSION;
+    header.flags = 0;
+#ifdef UNIT_TRACE_DEBUG_NANO
+    header.flags |= TRACE_DEBUG_BINARY_UNIT_NANO;
+#endif
+#ifdef ENABLE_THREAD_SAFE
+    header.flags |= TRACE_DEBUG_BINARY_THREAD_ID;
+#endif
+    header.reserved = 0;
+    outputFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    // A new file does not know any definition yet
+    binaryCallSitesWritten.clear();
+    binaryThreadIndexes.clear();
+    binaryLabelIds.clear();
+#elif defined(TRACE_DEBUG_CHROME_TRACE)
+    outputFile.open(tmpFileName + extension, std::ofstream::out | std::ofstream::binary);
+    outputFile << "[";
+    // A new file does not know any thread yet
+    chromeTraceThreadIds.clear();
+    chromeTraceEventCount = 0;
+#elif defined(TRACE_DEBUG_MAPPED_OUTPUT)
+    static bool mappingFailed = false;
+    if (!mappedFile.Open(tmpFileName + extension, TRACE_DEBUG_MAPPED_OUTPUT_SIZE) && !mappingFailed)
+    {
+      // Traces are lost: only said once
+      mappingFailed = true;
+      std::cerr << "TraceDebug: cannot map " << tmpFileName + extension << std::endl;
+    }
+#else
+    outputFile.open(tmpFileName + extension, std::ofstream::out);
+#endif
+  }
+}
+#endif
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+bool TraceDebugMappedFile::Open(const std::string& fileName, unsigned long long dataSize)
+{
+  const unsigned long long fileSize = sizeof(TraceDebugMappedHeader) + dataSize;
+  void* mapping = nullptr;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_NEW,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  // The file is extended to the size of the mapping
+  HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(fileSize >> 32),
+                                          static_cast<DWORD>(fileSize & 0xFFFFFFFFULL), nullptr);
+  if (fileMapping != nullptr)
+  {
+    mapping = MapViewOfFile(fileMapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(fileSize));
+    CloseHandle(fileMapping);
+  }
+  // The view keeps the file open
+  CloseHandle(file);
+#else
+  const int descriptor = open(fileName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (descriptor < 0)
+    return false;
+  if (ftruncate(descriptor, static_cast<off_t>(fileSize)) == 0)
+  {
+    mapping = mmap(nullptr, static_cast<size_t>(fileSize), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    if (mapping == MAP_FAILED)
+      mapping = nullptr;
+  }
+  // The mapping keeps the file open
+  close(descriptor);
+#endif
+  if (mapping == nullptr)
+    return false;
+
+  header = static_cast<TraceDebugMappedHeader*>(mapping);
+  data = static_cast<char*>(mapping) + sizeof(TraceDebugMappedHeader);
+  std::memset(header, 0, sizeof(TraceDebugMappedHeader));
+  std::memcpy(header->magic, TRACE_DEBUG_MAPPED_MAGIC, sizeof(header->magic));
+  header->byteOrderMark = TRACE_DEBUG_MAPPED_BYTE_ORDER_MARK;
+  header->version = TRACE_DEBUG_MAPPED_VERSION;
+  header->dataSize = dataSize;
+  return true;
+}
+
+// ==============================================================================================================================
+void TraceDebugMappedFile::Write(const char* bytes, size_t size)
+{
+  if (header == nullptr || header->dataSize == 0)
+    return;
+  const uint64_t dataSize = header->dataSize;
+  uint64_t cursor = header->cursor;
+  uint64_t wrapCount = header->wrapCount;
+  // Only the end of what does not fit would be kept: the beginning is skipped
+  if (size > dataSize)
+  {
+    const uint64_t skippedCursor = cursor + (size - dataSize);
+    wrapCount += skippedCursor / dataSize;
+    cursor = skippedCursor % dataSize;
+    bytes += size - dataSize;
+    size = static_cast<size_t>(dataSize);
+  }
+  const size_t firstPart = static_cast<size_t>(std::min<uint64_t>(size, dataSize - cursor));
+  std::memcpy(data + cursor, bytes, firstPart);
+  std::memcpy(data, bytes + firstPart, size - firstPart);
+  cursor += size;
+  if (cursor >= dataSize)
+  {
+    cursor -= dataSize;
+    ++wrapCount;
+  }
+  // Updated once the bytes are written: a crash while copying only damages the oldest line
+  header->wrapCount = wrapCount;
+  header->cursor = cursor;
+}
+
+// ==============================================================================================================================
+void TraceDebugMappedFile::Close()
+{
+  if (header == nullptr)
+    return;
+  header->closed = 1;
+  const size_t fileSize = static_cast<size_t>(sizeof(TraceDebugMappedHeader) + header->dataSize);
+#ifdef _WIN32
+  (void)fileSize;
+  UnmapViewOfFile(header);
+#else
+  munmap(header, fileSize);
+#endif
+  header = nullptr;
+  data = nullptr;
+}
+#endif
+
+// ==============================================================================================================================
+#ifdef TRACE_DEBUG_LOCK_FREE
+void TraceDebug::PushToThreadBuffer(TraceDebugEvent&& output)
+{
+  if (!threadBuffer)
+  {
+    threadBuffer = std::make_shared<TraceDebugThreadBuffer>();
+    {
+      std::lock_guard<std::mutex> lock(threadBuffersMutex);
+      threadBuffers.push_back(threadBuffer);
+    }
+    StartWriterThread();
+  }
+  if (!threadBuffer->traces.Push(std::move(output)))
+  {
+    threadBuffer->droppedTraces.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// ==============================================================================================================================
+void TraceDebug::DrainThreadBuffers()
+{
+  GET_OUTPUT_GUARD;
+  std::lock_guard<std::mutex> lock(threadBuffersMutex);
+  for (auto it = threadBuffers.begin(); it != threadBuffers.end();)
+  {
+    // Only referenced by this list: the thread exited and will not push anything anymore
+    const bool threadExited = it->use_count() == 1;
+    (*it)->traces.Drain([](TraceDebugEvent&& output) { CacheOrPrintOutputs(std::move(output)); });
+    const unsigned long long dropped = (*it)->droppedTraces.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+      droppedTraces += dropped;
+      TraceDebugEvent event = CreateEvent(TraceDebugEventKind::Text, false);
+      event.text = std::to_string(dropped) + " traces dropped: thread buffer full"
+                   " (increase TRACE_DEBUG_RING_BUFFER_SIZE)";
+      CacheOrPrintOutputs(std::move(event));
+    }
+    if (threadExited)
+    {
+      it = threadBuffers.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
   }
-
 }
 
+#endif
+
 // ==============================================================================================================================
-void TraceDebug::DisplayPerformanceMeasure() {
-  // Automatically add an end of measure trace points when getting out of scope
-  AddTrace(std::chrono::steady_clock::now(), "End measure");
-  std::string timingInformation = GetPerformanceResults();
-  if(!timingInformation.empty()) CacheOrPrintTimings(std::move(timingInformation));
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+void TraceDebug::WriteAsync(TraceDebugEvent&& output)
+{
+  std::unique_lock<std::mutex> lock(writerMutex);
+  pendingOutputs.push_back(std::move(output));
+  const bool writerStarted = writerThread.joinable();
+  const bool batchFull = pendingOutputs.size() >= TRACE_DEBUG_WRITER_BATCH_SIZE;
+  lock.unlock();
+  if (!writerStarted)
+  {
+    StartWriterThread();
+  }
+  else if (batchFull)
+  {
+    writerCondition.notify_one();
+  }
 }
 
 // ==============================================================================================================================
-void TraceDebug::CacheOrPrintTimings(std::string&& output) {
-  // Is the cache enabled ?
-  if(traceCacheDeepness > 1) {
-    localCache.push_back(output);
-    // Print all cache information when maximum cache size happened
-    if(localCache.size() >= traceCacheDeepness) {
-      auto startPrintingCacheTime = std::chrono::steady_clock::now();
-      localCache.push_back(GetPerformanceResults());
-      PrintCache();
-      // Update all still existing trace points that their measures will be impacted because of the cache display
-      AddTrace(startPrintingCacheTime, "Start Printing cache");
-      auto endPrintingCacheTime = std::chrono::steady_clock::now();
-      AddTrace(endPrintingCacheTime, "Done Printing cache");
-      PRINT_RESULT(GetPerformanceResults());
-      for(auto& tmpPair: mapFileNameFunctionNameToVectorTimingInfo) {
-        for(auto& pairElement: tmpPair.second) {
-          pairElement.first = "(***!!! Printing inducted " +
-                               std::to_string(std::chrono::duration <double, UNIT_TRACE_TEMPLATE_TYPE> (
-                                   endPrintingCacheTime - startPrintingCacheTime).count()) +
-                               std::string(UNIT_TRACE_DEBUG)+ " overhead in this measure !!!***)" + pairElement.first;
-        }
-      }
-    }
-  } else {
-    PRINT_RESULT(output);
+void TraceDebug::StartWriterThread()
+{
+  std::lock_guard<std::mutex> lock(writerMutex);
+  // The writer is not restarted while Finalize is running
+  if (!writerThread.joinable() && !writerStopRequested)
+  {
+    // Write all pending outputs when the program ends
+    FinalizeAtExit();
+    writerThread = std::thread(&TraceDebug::WriteOutputs);
   }
 }
 
 // ==============================================================================================================================
-void TraceDebug::CacheOrPrintOutputs(std::string&& output) {
-  // If the cache is enabled, store output into cache
-  // If the cache reached its limit print it out
-  if(traceCacheDeepness > 1) {
-    localCache.push_back(output);
-    if(localCache.size() > traceCacheDeepness - 1) {
-      PrintCache();
-    }
-  } else {
-    // Display results without caching information
-    PRINT_RESULT(output);
+void TraceDebug::StopWriterThread()
+{
+  std::thread writer;
+  {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    writerStopRequested = true;
+    writer = std::move(writerThread);
+  }
+  writerCondition.notify_all();
+  if (writer.joinable())
+  {
+    writer.join();
   }
-
 }
 
 // ==============================================================================================================================
-void TraceDebug::AddTrace(std::chrono::steady_clock::time_point timePoint, const std::string & variableName) {
-
-  GET_THREAD_SAFE_GUARD;
-  // Associate name of variable with time information
-  std::pair<std::string, std::chrono::steady_clock::time_point> tmpPair = std::make_pair(variableName, timePoint);
-
-  // Append structure to the map mapFileNameFunctionNameToVectorTimingInfo referenced by the key keyDebugPerformanceToErase
-  auto vectorTimingInfoIt = mapFileNameFunctionNameToVectorTimingInfo.find(keyDebugPerformanceToErase);
-  if(vectorTimingInfoIt == mapFileNameFunctionNameToVectorTimingInfo.end()) {
-    std::vector<std::pair<std::string, std::chrono::steady_clock::time_point>> tmpVector;
-    tmpVector.push_back(tmpPair);
-    mapFileNameFunctionNameToVectorTimingInfo[keyDebugPerformanceToErase] = std::move(tmpVector);
-  } else {
-    vectorTimingInfoIt->second.push_back(tmpPair);
+void TraceDebug::WriteOutputs()
+{
+  std::vector<TraceDebugEvent> events;
+  std::string batch;
+  auto lastFlushTime = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(writerMutex);
+  while (!writerStopRequested)
+  {
+#ifdef TRACE_DEBUG_LOCK_FREE
+    writerCondition.wait_for(lock, std::chrono::milliseconds(TRACE_DEBUG_DRAIN_INTERVAL_MS));
+    lock.unlock();
+    DrainThreadBuffers();
+    lock.lock();
+#else
+    writerCondition.wait_for(lock, std::chrono::milliseconds(outputFlushIntervalMs));
+#endif
+    events.swap(pendingOutputs);
+    lock.unlock();
+    // Formatting is done here, out of the traced threads
+    for (const TraceDebugEvent& event : events)
+    {
+      AppendEvent(event, batch);
+    }
+    events.clear();
+    const auto now = std::chrono::steady_clock::now();
+    const bool flush = now - lastFlushTime >= std::chrono::milliseconds(outputFlushIntervalMs);
+#ifdef TRACE_DEBUG_CHROME_TRACE
+    // The counter tracks get a point per flush interval
+    if (flush)
+    {
+      AppendChromeCounters(batch);
+    }
+#endif
+    if (!batch.empty() || flush)
+    {
+      WriteBatch(batch, flush);
+      batch.clear();
+    }
+    if (flush)
+    {
+      lastFlushTime = now;
+    }
+    lock.lock();
   }
-
 }
+#endif
 
 // ==============================================================================================================================
-void TraceDebug::ActiveTrace(bool activate) {
-  GET_THREAD_SAFE_GUARD;
-  traceActive = activate;
+#if defined(TRACE_DEBUG_ASYNC_WRITER) || defined(TRACE_DEBUG_STRUCTURED_OUTPUT)
+void TraceDebug::WriteBatch(const std::string& batch, bool flush)
+{
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+  (void)flush;
+  if (!batch.empty())
+  {
+    OpenOutputFile(TRACE_DEBUG_OUTPUT_FILE_NAME);
+    mappedFile.Write(batch.data(), batch.size());
+  }
+#elif defined(WRITE_OUTPUT_TO_FILE)
+  // A flush after Finalize closed the file must not create a new empty file
+  if (!batch.empty())
+  {
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+    // The batch is split between segments after the line reaching the size of the segment
+    for (size_t begin = 0, end; begin < batch.size(); begin = end)
+    {
+      OpenOutputFile(TRACE_DEBUG_OUTPUT_FILE_NAME);
+      const unsigned long long segmentSize = TRACE_DEBUG_ROTATE_SIZE;
+      const size_t room = static_cast<size_t>(segmentSize > outputSegmentSize ? segmentSize - outputSegmentSize : 0);
+      end = room < batch.size() - begin ? batch.find('\n', begin + room) : std::string::npos;
+      end = end == std::string::npos ? batch.size() : end + 1;
+      outputFile.write(batch.data() + begin, end - begin);
+      outputSegmentSize += end - begin;
+      RotateOutputFile();
+    }
+#else
+    OpenOutputFile(TRACE_DEBUG_OUTPUT_FILE_NAME);
+    outputFile.write(batch.data(), batch.size());
+#endif
+  }
+  if (flush && outputFile.is_open())
+    outputFile.flush();
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+  // A segment older than the rotation interval is closed even without new traces
+  RotateOutputFile();
+#endif
+#elif defined(USE_QT_DEBUG)
+  (void)flush;
+  // qDebug appends its own new line
+  for (size_t begin = 0, end; begin < batch.size(); begin = end + 1)
+  {
+    end = batch.find('\n', begin);
+    qDebug() << QString::fromUtf8(batch.data() + begin, static_cast<int>(end - begin));
+  }
+#else
+  std::cout.write(batch.data(), batch.size());
+  if (flush)
+    std::cout.flush();
+#endif
 }
+#endif
 
 // ==============================================================================================================================
-bool TraceDebug::IsTraceActive() {
-  GET_THREAD_SAFE_GUARD;
-  return traceActive;
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+void TraceDebug::RotateOutputFile()
+{
+  if (!outputFile.is_open())
+    return;
+  const unsigned long long segmentSize = TRACE_DEBUG_ROTATE_SIZE;
+  const bool sizeReached = outputSegmentSize >= segmentSize;
+  const bool ageReached = TRACE_DEBUG_ROTATE_INTERVAL_S > 0 &&
+                          std::chrono::steady_clock::now() - outputSegmentOpenTime >= std::chrono::seconds(TRACE_DEBUG_ROTATE_INTERVAL_S);
+  // The next write opens the next segment
+  if (sizeReached || ageReached)
+    CloseOutputSegment();
 }
 
 // ==============================================================================================================================
-std::string TraceDebug::getSpaces() {
-  if(GetDebugPrintDeepness() > 1) {
-    return std::string(2 * (GetDebugPrintDeepness() - 1), ' ');
+void TraceDebug::CloseOutputSegment()
+{
+  if (!outputFile.is_open())
+    return;
+  outputFile.close();
+  {
+    std::lock_guard<std::mutex> lock(archiveMutex);
+    pendingSegments.push_back(outputSegmentBaseName + "." + std::to_string(outputSegmentNumber) + ".log");
+    if (!archiveThread.joinable())
+      archiveThread = std::thread(&TraceDebug::ArchiveSegments);
   }
-  return "";
+  archiveCondition.notify_one();
 }
 
 // ==============================================================================================================================
-void TraceDebug::PrintString(const std::string & inStr, bool showHierarchy) {
-  GET_THREAD_SAFE_GUARD;
-  std::string str;
-  if(showHierarchy) {
-    str = TraceDebug::getSpaces() + inStr;
-  } else {
-    str = inStr;
+void TraceDebug::StopArchiveThread()
+{
+  std::thread archiver;
+  {
+    std::lock_guard<std::mutex> lock(archiveMutex);
+    archiveStopRequested = true;
+    archiver = std::move(archiveThread);
+  }
+  archiveCondition.notify_all();
+  if (archiver.joinable())
+  {
+    archiver.join();
   }
-  CacheOrPrintOutputs(std::move(str));
+  // Segments closed later start a new archive thread
+  std::lock_guard<std::mutex> lock(archiveMutex);
+  archiveStopRequested = false;
 }
 
 // ==============================================================================================================================
-std::string TraceDebug::GetPerformanceResults() {
-  // Get performance info for key keyDebugPerformanceToErase
-  auto performanceInfos = mapFileNameFunctionNameToVectorTimingInfo[keyDebugPerformanceToErase];
-
-  std::string tmp = TraceDebug::getSpaces() + TraceDebug::GetDiffTimeSinceStartAndThreadId() + ":" + lineHeader;
-
-  // If the number of information stored is greater than 1 a difference can be computed
-  auto size = performanceInfos.size() - 1;
-  if(size > 0) {
-    // Compute all timing differences
-    for(decltype(size) index = 0; index < size; ++index)
+void TraceDebug::ArchiveSegments()
+{
+  std::vector<std::string> segments;
+  std::unique_lock<std::mutex> lock(archiveMutex);
+  for (;;)
+  {
+    archiveCondition.wait(lock, [] { return archiveStopRequested || !pendingSegments.empty(); });
+    // Segments closed before the stop request are still archived
+    if (pendingSegments.empty())
+      break;
+    segments.swap(pendingSegments);
+    lock.unlock();
+    for (const std::string& segment : segments)
     {
-      const auto& valueMin = performanceInfos[index];
-      const auto& valueMax = performanceInfos[index + 1];
-      if(!tmp.empty())
+#ifdef TRACE_DEBUG_COMPRESS_OUTPUT
+      archivedSegments.push_back(CompressSegment(segment));
+#else
+      archivedSegments.push_back(segment);
+#endif
+      while (archivedSegments.size() > TRACE_DEBUG_ROTATE_SEGMENTS)
       {
-        tmp += ", ";
+        std::remove(archivedSegments.front().c_str());
+        archivedSegments.pop_front();
       }
-      tmp += "<" + valueMax.first + "> - <" + valueMin.first + "> = "
-             + std::to_string(
-                       std::chrono::duration<double, UNIT_TRACE_TEMPLATE_TYPE>(
-                               valueMax.second - valueMin.second)
-                               .count())
-             + std::string(UNIT_TRACE_DEBUG);
-    }
-    if(size > 1)
-    {
-      const auto& valueMin = performanceInfos[0];
-      const auto& valueMax = performanceInfos[size];
-      tmp += ", Full time: "
-             + std::to_string(
-                       std::chrono::duration<double, UNIT_TRACE_TEMPLATE_TYPE>(
-                               valueMax.second - valueMin.second)
-                               .count())
-             + std::string(UNIT_TRACE_DEBUG);
     }
+    segments.clear();
+    lock.lock();
   }
-  else if (size == 1)
-  {
-    // We have 1 timing information only, no difference can be computed
-    tmp += ": Not enough trace to display results.";
-  }
-  else
-  {
-    tmp = "";
-  }
-  return tmp;
 }
 
 // ==============================================================================================================================
-void TraceDebug::SetTracePerformanceCacheDeepness(unsigned int cacheDeepness)
+#ifdef TRACE_DEBUG_COMPRESS_OUTPUT
+std::string TraceDebug::CompressSegment(const std::string& fileName)
 {
-  GET_THREAD_SAFE_GUARD;
-  if (cacheDeepness != traceCacheDeepness)
+  const std::string compressedFileName = fileName + ".gz";
+  std::ifstream input(fileName, std::ifstream::in | std::ifstream::binary);
+  gzFile output = gzopen(compressedFileName.c_str(), "wb");
+  bool compressed = input.is_open() && output != nullptr;
+  std::vector<char> buffer(256 * 1024);
+  while (compressed && input)
   {
-    traceCacheDeepness = cacheDeepness;
-    // Set a little bigger as the time for displaying output will
-    // automatically be added.
-    localCache.reserve(traceCacheDeepness + 3);
+    input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    const int readSize = static_cast<int>(input.gcount());
+    if (readSize > 0 && gzwrite(output, buffer.data(), static_cast<unsigned int>(readSize)) != readSize)
+      compressed = false;
+  }
+  if (output != nullptr && gzclose(output) != Z_OK)
+    compressed = false;
+  input.close();
+  // A segment which could not be compressed is kept as is
+  if (!compressed)
+  {
+    std::remove(compressedFileName.c_str());
+    std::cerr << "TraceDebug: cannot compress " << fileName << std::endl;
+    return fileName;
   }
+  std::remove(fileName.c_str());
+  return compressedFileName;
 }
+#endif
+#endif
 
 // ==============================================================================================================================
-void TraceDebug::Finalize()
-{
-  // This method is called by a guard statically created that will
-  // automatically expire when the program expires.
-  GET_THREAD_SAFE_GUARD;
-  TraceDebug::PrintCache();
-#ifdef WRITE_OUTPUT_TO_FILE
-  if (outputFile.is_open())
-    outputFile.close();
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+class TraceDebugSignalWriter {
+    int fileDescriptor;
+    char buffer[1024];
+    size_t size = 0;
+
+  public:
+    explicit TraceDebugSignalWriter(int fileDescriptor): fileDescriptor(fileDescriptor) {}
+    ~TraceDebugSignalWriter() { Flush(); }
+
+    void Write(const char* data, size_t length) {
+      while(length > 0) {
+        if(size == sizeof(buffer)) {
+          Flush();
+        }
+        const size_t copied = std::min(length, sizeof(buffer) - size);
+        std::memcpy(buffer + size, data, copied);
+        size += copied;
+        data += copied;
+        length -= copied;
+      }
+    }
+    void Write(const char* text) { Write(text, std::strlen(text)); }
+    void Write(const std::string& text) { Write(text.data(), text.size()); }
+    void WriteSpaces(unsigned int count) {
+      for(unsigned int index = 0; index < count; ++index) {
+        Write(" ", 1);
+      }
+    }
+    void WriteNumber(unsigned long long value, unsigned int minimumDigits = 1) {
+      char digits[24];
+      unsigned int count = 0;
+      do {
+        digits[sizeof(digits) - ++count] = static_cast<char>('0' + value % 10);
+        value /= 10;
+      } while(value > 0 || count < minimumDigits);
+      Write(digits + sizeof(digits) - count, count);
+    }
+    void WriteSignedNumber(long long value) {
+      if(value < 0) {
+        Write("-", 1);
+        WriteNumber(0ULL - static_cast<unsigned long long>(value));
+      } else {
+        WriteNumber(static_cast<unsigned long long>(value));
+      }
+    }
+    // Same precision as std::to_string
+    void WriteFloatingPoint(double value) {
+      if(value != value) {
+        Write("nan");
+        return;
+      }
+      if(value < 0.) {
+        Write("-", 1);
+        value = -value;
+      }
+      if(value >= 1e19) {
+        Write("inf");
+        return;
+      }
+      unsigned long long integer = static_cast<unsigned long long>(value);
+      unsigned long long decimals = static_cast<unsigned long long>((value - static_cast<double>(integer)) * 1e6 + 0.5);
+      if(decimals >= 1000000) {
+        ++integer;
+        decimals -= 1000000;
+      }
+      WriteNumber(integer);
+      Write(".", 1);
+      WriteNumber(decimals, 6);
+    }
+    // Same format as TraceDebug::FormatDuration
+    void WriteDuration(long long nanoseconds) {
+#ifdef UNIT_TRACE_DEBUG_NANO
+      WriteSignedNumber(nanoseconds);
+      Write(".000000");
+#else
+      if(nanoseconds < 0) {
+        Write("-", 1);
+        nanoseconds = -nanoseconds;
+      }
+      WriteNumber(static_cast<unsigned long long>(nanoseconds) / 1000000);
+      Write(".", 1);
+      WriteNumber(static_cast<unsigned long long>(nanoseconds) % 1000000, 6);
 #endif
+      Write(UNIT_TRACE_DEBUG);
+    }
+    void Flush() {
+      for(size_t written = 0; written < size;) {
+        const ssize_t result = ::write(fileDescriptor, buffer + written, size - written);
+        if(result <= 0) {
+          break;
+        }
+        written += static_cast<size_t>(result);
+      }
+      size = 0;
+    }
+};
+
+namespace {
+  const int fatalSignals[] = { SIGSEGV, SIGABRT, SIGBUS, SIGFPE };
+  struct sigaction previousSignalActions[sizeof(fatalSignals) / sizeof(fatalSignals[0])];
+  // The thread installing the handler can report the overflow of its stack
+  char signalStack[64 * 1024];
+
+  const char* GetSignalName(int signalNumber) {
+    switch(signalNumber) {
+      case SIGSEGV: return "SIGSEGV";
+      case SIGABRT: return "SIGABRT";
+      case SIGBUS:  return "SIGBUS";
+      case SIGFPE:  return "SIGFPE";
+      default:      return "signal";
+    }
+  }
 }
 
 // ==============================================================================================================================
-std::string TraceDebug::GetDiffTimeSinceStartAndThreadId()
-{
-  std::chrono::duration <double, UNIT_TRACE_TEMPLATE_TYPE> elapsedTime =
-      std::chrono::system_clock::now().time_since_epoch();
-  std::string returnValue =
-          std::to_string(elapsedTime.count()) + UNIT_TRACE_DEBUG;
-#ifdef ENABLE_THREAD_SAFE
+TraceDebugThreadScopes::TraceDebugThreadScopes(): depth(0), threadId(std::this_thread::get_id()) {
   std::ostringstream buffer;
-  buffer << std::this_thread::get_id();
-  returnValue += ":" + buffer.str();
-#endif
-  return returnValue;
+  buffer << threadId;
+  const std::string text = buffer.str();
+  const size_t length = std::min(text.size(), sizeof(threadIdText) - 1);
+  std::memcpy(threadIdText, text.data(), length);
+  threadIdText[length] = '\0';
+  TraceDebug::RegisterThreadScopes(*this);
 }
 
 // ==============================================================================================================================
-void TraceDebug::DisplayStartTracePerformance(
-        bool inDisplayStartTracePerformance)
-{
-  GET_THREAD_SAFE_GUARD;
-  displayStartTracePerformance = inDisplayStartTracePerformance;
+TraceDebugThreadScopes::~TraceDebugThreadScopes() {
+  TraceDebug::UnregisterThreadScopes(*this);
 }
 
 // ==============================================================================================================================
-void TraceDebug::PrintCache()
-{
-  if (localCache.size() > 0)
-  {
-    for (const std::string& str : localCache)
-    {
-      PRINT_RESULT(str);
+void TraceDebug::RegisterThreadScopes(TraceDebugThreadScopes& scopes) {
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  scopes.flightRecorder = &flightRecorder;
+#endif
+  // Threads beyond TRACE_DEBUG_SIGNAL_MAX_THREADS are not displayed
+  for(std::atomic<TraceDebugThreadScopes*>& slot: allThreadScopes) {
+    TraceDebugThreadScopes* expected = nullptr;
+    if(slot.compare_exchange_strong(expected, &scopes, std::memory_order_acq_rel)) {
+      return;
     }
-    localCache.clear();
   }
 }
 
 // ==============================================================================================================================
-void TraceDebug::IncreaseDebugPrintDeepness()
-{
-#ifdef ENABLE_THREAD_SAFE
-  ++debugPrintDeepness[std::this_thread::get_id()];
-#else
-  ++debugPrintDeepness;
-#endif
+void TraceDebug::UnregisterThreadScopes(TraceDebugThreadScopes& scopes) {
+  for(std::atomic<TraceDebugThreadScopes*>& slot: allThreadScopes) {
+    TraceDebugThreadScopes* expected = &scopes;
+    if(slot.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel)) {
+      return;
+    }
+  }
 }
 
 // ==============================================================================================================================
-void TraceDebug::DecreaseDebugPrintDeepness()
-{
-#ifdef ENABLE_THREAD_SAFE
-  --debugPrintDeepness[std::this_thread::get_id()];
-#else
-  --debugPrintDeepness;
-#endif
+void TraceDebug::InstallSignalHandler(int fileDescriptor) {
+  TRACE_DEBUG_IGNORE_ALLOCATIONS;
+  signalFileDescriptor = fileDescriptor;
+  // Everything the handler uses is initialized now: the clock calibration and the scopes of this thread
+  TraceDebugClock::ToEpochNanoseconds(TraceDebugClock::Now());
+  (void)threadScopes.depth.load(std::memory_order_relaxed);
+  stack_t alternateStack;
+  alternateStack.ss_sp = signalStack;
+  alternateStack.ss_size = sizeof(signalStack);
+  alternateStack.ss_flags = 0;
+  sigaltstack(&alternateStack, nullptr);
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = &TraceDebug::HandleFatalSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_ONSTACK;
+  for(size_t index = 0; index < sizeof(fatalSignals) / sizeof(fatalSignals[0]); ++index) {
+    sigaction(fatalSignals[index], &action, &previousSignalActions[index]);
+  }
 }
 
 // ==============================================================================================================================
-unsigned int TraceDebug::GetDebugPrintDeepness()
-{
-#ifdef ENABLE_THREAD_SAFE
-  return debugPrintDeepness[std::this_thread::get_id()];
-#else
-  return debugPrintDeepness;
-#endif
+const char* TraceDebug::GetThreadIdText(std::thread::id threadId) {
+  for(const std::atomic<TraceDebugThreadScopes*>& slot: allThreadScopes) {
+    const TraceDebugThreadScopes* scopes = slot.load(std::memory_order_acquire);
+    if(scopes != nullptr && scopes->threadId == threadId) {
+      return scopes->threadIdText;
+    }
+  }
+  // The thread exited
+  return "?";
 }
 
 // ==============================================================================================================================
-unsigned int TraceDebug::GetAllDebugPrintDeepness()
-{
+void TraceDebug::WriteSignalEvent(TraceDebugSignalWriter& writer, const TraceDebugEvent& event) {
+  writer.WriteSpaces(event.deepness > 1 ? 2 * (event.deepness - 1) : 0);
+  if(event.kind == TraceDebugEventKind::Text || event.callSite == nullptr) {
+    writer.Write(event.text);
+    writer.Write("\n", 1);
+    return;
+  }
+  const TraceDebugCallSite& site = *event.callSite;
+  writer.WriteDuration(TraceDebugClock::ToEpochNanoseconds(event.time));
 #ifdef ENABLE_THREAD_SAFE
-  return std::accumulate(
-          debugPrintDeepness.begin(), debugPrintDeepness.end(), 0,
-                         [](unsigned int a, std::pair<std::thread::id, unsigned int> b) {
-    return a + b.second;
-  });
-#else
-  return GetDebugPrintDeepness();
+  writer.Write(":");
+  writer.Write(GetThreadIdText(event.threadId));
+#endif
+  writer.Write(":");
+  if(event.kind == TraceDebugEventKind::ProcessingValue) {
+    writer.Write("Processing ");
+    writer.Write(site.label);
+    writer.Write("  From ");
+  } else if(event.kind == TraceDebugEventKind::Value) {
+    writer.Write("->");
+  }
+  writer.Write(site.fileName);
+  writer.Write(":");
+  writer.WriteSignedNumber(site.lineNumber);
+  writer.Write(" (");
+  writer.Write(site.functionName);
+  writer.Write(")");
+  switch(event.kind) {
+    case TraceDebugEventKind::StartMeasure:
+      writer.Write(" [");
+      writer.Write(site.label);
+      writer.Write("]  Start measure");
+      break;
+    case TraceDebugEventKind::EndMeasure: {
+      writer.Write(" [");
+      writer.Write(site.label);
+      writer.Write("]");
+      const TraceDebugTimings& timings = event.timings;
+      for(size_t index = 0; index + 1 < timings.size(); ++index) {
+        writer.Write(", <");
+        writer.Write(timings[index + 1].label);
+        writer.Write("> - <");
+        writer.Write(timings[index].label);
+        writer.Write("> = ");
+        writer.WriteDuration(TraceDebugClock::ToNanoseconds(timings[index + 1].time - timings[index].time));
+      }
+      if(timings.size() > 2) {
+        writer.Write(", Full time: ");
+        writer.WriteDuration(TraceDebugClock::ToNanoseconds(timings.back().time - timings.front().time));
+      }
+      break;
+    }
+    case TraceDebugEventKind::ProcessingValue:
+      break;
+    default: {
+      writer.Write("  ");
+      if(event.kind != TraceDebugEventKind::Message) {
+        writer.Write(site.label);
+        writer.Write(" = ");
+      }
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+      // Same values as TraceDebugArguments::Format
+      const TraceDebugArguments& arguments = event.arguments;
+      for(size_t index = 0; index < arguments.size;) {
+        const unsigned char type = arguments.data[index++];
+        if(type == TraceDebugArguments::Character) {
+          writer.Write(reinterpret_cast<const char*>(arguments.data + index), 1);
+          ++index;
+        } else if(type == TraceDebugArguments::String) {
+          unsigned short length;
+          std::memcpy(&length, arguments.data + index, sizeof(length));
+          writer.Write(reinterpret_cast<const char*>(arguments.data + index + sizeof(length)), length);
+          index += sizeof(length) + length;
+        } else if(type == TraceDebugArguments::Boolean) {
+          bool value;
+          std::memcpy(&value, arguments.data + index, sizeof(value));
+          writer.WriteNumber(value ? 1 : 0);
+          index += sizeof(value);
+        } else if(type == TraceDebugArguments::FloatingPoint) {
+          double value;
+          std::memcpy(&value, arguments.data + index, sizeof(value));
+          writer.WriteFloatingPoint(value);
+          index += sizeof(value);
+        } else if(type == TraceDebugArguments::Signed) {
+          long long value;
+          std::memcpy(&value, arguments.data + index, sizeof(value));
+          writer.WriteSignedNumber(value);
+          index += sizeof(value);
+        } else {
+          unsigned long long value;
+          std::memcpy(&value, arguments.data + index, sizeof(value));
+          writer.WriteNumber(value);
+          index += sizeof(value);
+        }
+      }
 #endif
+      writer.Write(event.text);
+      break;
+    }
+  }
+  writer.Write("\n", 1);
 }
 
 // ==============================================================================================================================
-#ifdef WRITE_OUTPUT_TO_FILE
-void TraceDebug::WriteToFile(const std::string& stringToWrite,
-                             const std::string& fileName)
-{
-  GET_THREAD_SAFE_GUARD;
-  static Guard guardOnLeavingProgram;
-  if (!outputFile.is_open())
-  {
-    // Search for a non existing filename
-    std::string tmpFileName = fileName + "-" + std::to_string(GETPID);
-    struct stat buffer;
-    for (int index = 0; stat(tmpFileName.c_str(), &buffer) == 0; ++index)
-    {
-      tmpFileName = fileName + std::to_string(index);
+void TraceDebug::HandleFatalSignal(int signalNumber) {
+  // Only async-signal-safe calls: no lock, no allocation, no stream. The traces are read as they are, even if a thread
+  // is writing them
+  if(!signalReceived.exchange(true)) {
+    TraceDebugSignalWriter writer(signalFileDescriptor);
+    writer.Write("TraceDebug: ");
+    writer.Write(GetSignalName(signalNumber));
+    writer.Write(" received by thread ");
+    writer.Write(GetThreadIdText(std::this_thread::get_id()));
+    writer.Write(", traces not written yet:\n");
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+    for(const TraceDebugEvent& event: pendingOutputs) {
+      WriteSignalEvent(writer, event);
+    }
+#endif
+    for(const TraceDebugEvent& event: localCache) {
+      WriteSignalEvent(writer, event);
+    }
+#ifdef TRACE_DEBUG_LOCK_FREE
+    for(const std::shared_ptr<TraceDebugThreadBuffer>& buffer: threadBuffers) {
+      buffer->traces.Peek([&writer](const TraceDebugEvent& event) { WriteSignalEvent(writer, event); });
+    }
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+    for(const std::atomic<TraceDebugThreadScopes*>& slot: allThreadScopes) {
+      const TraceDebugThreadScopes* scopes = slot.load(std::memory_order_acquire);
+      if(scopes == nullptr || scopes->flightRecorder == nullptr) {
+        continue;
+      }
+      // Oldest first
+      const std::vector<TraceDebugEvent>& events = scopes->flightRecorder->events;
+      for(size_t index = 0; index < events.size(); ++index) {
+        WriteSignalEvent(writer, events[(scopes->flightRecorder->next + index) % events.size()]);
+      }
+    }
+#endif
+    writer.Write("TraceDebug: scopes in progress:\n");
+    const TraceDebugClock::Ticks now = TraceDebugClock::Now();
+    for(const std::atomic<TraceDebugThreadScopes*>& slot: allThreadScopes) {
+      const TraceDebugThreadScopes* scopes = slot.load(std::memory_order_acquire);
+      const unsigned int depth = scopes != nullptr ? scopes->depth.load(std::memory_order_acquire) : 0;
+      if(depth == 0) {
+        continue;
+      }
+      writer.Write("Thread ");
+      writer.Write(scopes->threadIdText);
+      writer.Write(":\n");
+      for(unsigned int level = 0; level < depth && level < TraceDebugThreadScopes::maxDepth; ++level) {
+        const TraceDebugThreadScopes::Scope& scope = scopes->scopes[level];
+        writer.WriteSpaces(2 * (level + 1));
+        writer.Write(scope.callSite->fileName);
+        writer.Write(":");
+        writer.WriteSignedNumber(scope.callSite->lineNumber);
+        writer.Write(" (");
+        writer.Write(scope.callSite->functionName);
+        writer.Write(") [");
+        writer.Write(scope.callSite->label);
+        writer.Write("] since ");
+        writer.WriteDuration(TraceDebugClock::ToNanoseconds(now - scope.startTime));
+        writer.Write("\n", 1);
+      }
+      if(depth > TraceDebugThreadScopes::maxDepth) {
+        writer.WriteSpaces(2 * (TraceDebugThreadScopes::maxDepth + 1));
+        writer.WriteNumber(depth - TraceDebugThreadScopes::maxDepth);
+        writer.Write(" deeper scopes\n");
+      }
     }
-    outputFile.open(tmpFileName + ".log", std::ofstream::out);
   }
-  outputFile << stringToWrite << "\n";
-  // We need the output immidiately
-  outputFile.flush();
+  // The previous handler, or the default action, ends the program once this handler returns
+  for(size_t index = 0; index < sizeof(fatalSignals) / sizeof(fatalSignals[0]); ++index) {
+    if(fatalSignals[index] == signalNumber) {
+      sigaction(signalNumber, &previousSignalActions[index], nullptr);
+    }
+  }
+  raise(signalNumber);
 }
 #endif
 
-
 // ==============================================================================================================================
 // ==============================================================================================================================
 // ==============================================================================================================================
@@ -440,7 +3869,8 @@ int after_f1_mutex(int value)
 int f1()
 {
   auto value = before_f1_mutex();
-  std::lock_guard<std::mutex> lock(m_mutex);
+  TRACE_LOCK_GUARD(m_mutex);
+  TRACE_COUNTER("f1 calls", 1);
   value += after_f1_mutex(value);
   START_TRACE_PERFORMANCE(f1);
   DISPLAY_DEBUG_VALUE(f2() - 1);
@@ -451,9 +3881,9 @@ void test(std::string&& message)
 {
   DISPLAY_DEBUG_MESSAGE(message);
   std::srand(std::time(0));
-  auto handle1 = std::async(std::launch::async, f1);
-  auto handle2 = std::async(std::launch::async, f1);
-  auto handle3 = std::async(std::launch::async, f1);
+  auto handle1 = TRACE_ASYNC(std::launch::async, f1);
+  auto handle2 = TRACE_ASYNC(std::launch::async, f1);
+  auto handle3 = TRACE_ASYNC(std::launch::async, f1);
   START_TRACE_PERFORMANCE(test);
   DISPLAY_DEBUG_VALUE(f1());
   ADD_TRACE_PERFORMANCE(test, "This is the middle");
@@ -468,8 +3898,35 @@ void starting_again()
 {
 }
 
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+template <typename Stream>
+void format_values(Stream& stream)
+{
+  stream << "a=" << 5 << " hex=" << std::hex << 255 << " prec=" << std::setprecision(2) << 3.14159 << " w=[" << std::setw(5)
+         << 7 << "] " << std::string("text") << ' ' << true;
+}
+
+// The values of a DISPLAY_* macro must be displayed the same with and without TRACE_DEBUG_DEFERRED_FORMAT
+void check_deferred_format()
+{
+  TraceDebugDeferredValue deferred;
+  format_values(deferred);
+  std::ostringstream displayed;
+  deferred.arguments.Format(displayed);
+  displayed << deferred.GetText();
+  std::ostringstream expected;
+  format_values(expected);
+  if(displayed.str() != expected.str()) {
+    std::cerr << "Deferred format: \"" << displayed.str() << "\" instead of \"" << expected.str() << "\"" << std::endl;
+  }
+}
+#endif
+
 int main()
 {
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+  check_deferred_format();
+#endif
   while(true)
   {
     starting_again();
@@ -594,7 +4051,7 @@ int main()
         1497256661078.632080ms:6648:TraceDebug.cpp:416 (f3) [f3], <End measure> - <Start measure> = 0.055350ms
         1497256661078.632080ms:6872:TraceDebug.cpp:416 (f3) [f3]  Start measure
       1497256661077.632080ms:6648:->TraceDebug.cpp:424 (f2)  f3() = 5
-    1497256661078.632080ms:6648:TraceDebug.cpp:423 (f2) [f2], <Start measure> - <Start measure> = 0.039221ms, <End measure> - <Start measure> = 0.164584ms, Full time: 0.203805ms
+    1497256661078.632080ms:6648:TraceDebug.cpp:423 (f2) [f2], <End measure> - <Start measure> = 0.203805ms
           1497256661078.632080ms:6872:TraceDebug.cpp:418 (f3)  a = 5
 */
 #endif
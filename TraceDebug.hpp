@@ -14,6 +14,7 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #define __TRACE_DEBUG_HPP
 
 #include <map>
+#include <deque>
 #include <utility>
 #include <string>
 #include <vector>
@@ -25,21 +26,61 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <cstring>
 #include <thread>
 #include <mutex>
-#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <type_traits>
+#include <condition_variable>
+#include <future>
+#if __cplusplus >= 201402L
+#include <shared_mutex>
+#endif
 
 // Comment this line to completely disable traces
 #define ENABLE_TRACE_DEBUG
 #ifdef ENABLE_TRACE_DEBUG
 
   // Decomment this line when adding TraceDebug to your project
+  #ifndef TRACE_DEBUG_HPP_NO_DEBUG_LOCAL
   #define TRACE_DEBUG_HPP_DEBUG_LOCAL
+  #endif
 
   // Uncomment to disable threadsafe (Optimization)
   #define ENABLE_THREAD_SAFE
 
+  // If not commented, each thread writes its traces into its own lock free ring buffer which is drained by a
+  // writer thread: traces do not take the global mutex anymore (requires ENABLE_THREAD_SAFE)
+  //#define TRACE_DEBUG_LOCK_FREE
+
+  // If not commented, a writer thread does all the outputs (std::out, qDebug or file) in batches:
+  // threads being traced never wait for the output. Always enabled with TRACE_DEBUG_LOCK_FREE
+  //#define TRACE_DEBUG_ASYNC_WRITER
+
   // If not commented, write outputs into a file. Comment to write to std::out or qDebug
   //#define WRITE_OUTPUT_TO_FILE
 
+  // If not commented, traces are written into a compact binary file (TraceDebug-<pid>.bin) instead of text.
+  // Use TraceDebugDecoder to convert it back to text or csv. Enables WRITE_OUTPUT_TO_FILE
+  //#define TRACE_DEBUG_BINARY_OUTPUT
+
+  // If not commented, traces are written into a Chrome trace event file (TraceDebug-<pid>.json) instead of text,
+  // which can be opened by chrome://tracing or https://ui.perfetto.dev. Enables WRITE_OUTPUT_TO_FILE
+  //#define TRACE_DEBUG_CHROME_TRACE
+
+  // If not commented, text traces are copied into a memory mapped file (TraceDebug-<pid>.mmap) used as a circular buffer
+  // of TRACE_DEBUG_MAPPED_OUTPUT_SIZE bytes: nothing is flushed, the system keeps the pages written even if the program
+  // crashes. Use TraceDebugRecover to extract the last traces. Enables WRITE_OUTPUT_TO_FILE
+  //#define TRACE_DEBUG_MAPPED_OUTPUT
+
+  // If not commented, the text log is split into segments (TraceDebug-<pid>.<n>.log) of TRACE_DEBUG_ROTATE_SIZE bytes or
+  // TRACE_DEBUG_ROTATE_INTERVAL_S seconds, only the last TRACE_DEBUG_ROTATE_SEGMENTS closed segments are kept.
+  // Enables WRITE_OUTPUT_TO_FILE and TRACE_DEBUG_ASYNC_WRITER
+  //#define TRACE_DEBUG_ROTATE_OUTPUT
+
+  // If not commented, closed segments are compressed with zlib (TraceDebug-<pid>.<n>.log.gz) by a background thread.
+  // Link with -lz. Enables TRACE_DEBUG_ROTATE_OUTPUT
+  //#define TRACE_DEBUG_COMPRESS_OUTPUT
+
   // Commented writes to std::out. Otherwise uses qDebug: However if WRITE_OUTPUT_TO_FILE is defined, then
   // output will be written into a file
   //#define USE_QT_DEBUG
@@ -48,15 +89,229 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
   // If defined, traces are printed in ns otherwise in ms
   //#define UNIT_TRACE_DEBUG_NANO
 
+  // If not commented, times are read from the time stamp counter of x86 processors (rdtscp) instead of
+  // std::chrono::steady_clock and converted to ns only when traces are written. Requires an invariant TSC.
+  // Ignored on other processors
+  //#define TRACE_DEBUG_USE_TSC
+
+  // If not commented, DISPLAY_* macros only copy integers, floating points, characters and strings into the trace:
+  // they are formatted when the trace is written. Other types are still formatted by the traced thread.
+  //#define TRACE_DEBUG_DEFERRED_FORMAT
+
+  // If not commented, START_TRACE_PERFORMANCE does not display anything: count, mean, min, max and percentiles of each
+  // measured segment are displayed by TraceDebug::Finalize or PRINT_TRACE_PERFORMANCE_STATISTICS instead
+  //#define TRACE_DEBUG_AGGREGATE_STATISTICS
+
+  // If not commented, the cost of each trace macro is measured by the first trace and START_TRACE_PERFORMANCE
+  // displays, next to each duration, the duration without the cost of the traces done in the measured scope
+  //#define TRACE_DEBUG_OVERHEAD_COMPENSATION
+
+  // If not commented, nested START_TRACE_PERFORMANCE are merged into a call tree holding the calls, total and self time
+  // of each path of call sites. TraceDebug::Finalize or PRINT_TRACE_CALL_TREE display the call sites of highest self
+  // time, WRITE_TRACE_FOLDED_STACKS writes the tree for flame graph tools
+  //#define TRACE_DEBUG_CALL_TREE
+
+  // If not commented, on Linux each thread opens performance counters with perf_event_open and START_TRACE_PERFORMANCE
+  // displays, next to each duration, the cycles, instructions, cache misses and branch misses of the segment (or the task
+  // clock, page faults, context switches and CPU migrations when the kernel refuses hardware events). Ignored elsewhere
+  //#define TRACE_DEBUG_USE_PERF_COUNTERS
+
+  // If not commented, TraceDebug replaces the global operator new and delete to count the heap allocations of each thread, and
+  // START_TRACE_PERFORMANCE displays, next to each duration, the allocations and allocated bytes of the segment. The allocations
+  // done by TraceDebug itself are not counted. Cannot be used along with another replacement of the global operator new
+  //#define TRACE_DEBUG_COUNT_ALLOCATIONS
+
+  // If not commented, traces are not output: each thread keeps its last TRACE_DEBUG_FLIGHT_RECORDER_SIZE traces in memory and
+  // they are only output when a START_TRACE_PERFORMANCE lasts more than the threshold set for its call site by
+  // SET_TRACE_SLOW_THRESHOLD, at most once every TRACE_DEBUG_FLIGHT_RECORDER_DUMP_INTERVAL_MS per call site
+  //#define TRACE_DEBUG_FLIGHT_RECORDER
+
+  // If not commented, TRACE_INSTALL_SIGNAL_HANDLER(fileDescriptor) installs a handler of SIGSEGV, SIGABRT, SIGBUS and SIGFPE
+  // writing the traces not written yet (cache, writer thread, thread buffers, flight recorders) and the scopes in progress in
+  // each thread into fileDescriptor, with async-signal-safe calls only. Ignored on Windows
+  //#define TRACE_DEBUG_SIGNAL_HANDLER
+
+  // If not commented, START_TRACE_TIME_SERIES(fileName, intervalMs) starts a thread writing into fileName, every intervalMs, the
+  // count, mean, p50, p99 and max of each START_TRACE_PERFORMANCE segment measured during the interval, as CSV or JSON lines.
+  // Enables TRACE_DEBUG_AGGREGATE_STATISTICS
+  //#define TRACE_DEBUG_TIME_SERIES
+
+  // Number of traces each thread can buffer when TRACE_DEBUG_LOCK_FREE is defined (must be a power of 2).
+  // When a buffer is full new traces are dropped and the number of dropped traces is displayed.
+  #ifndef TRACE_DEBUG_RING_BUFFER_SIZE
+    #define TRACE_DEBUG_RING_BUFFER_SIZE 8192
+  #endif
+
+  // Period in ms at which the writer thread drains the thread buffers when TRACE_DEBUG_LOCK_FREE is defined
+  #ifndef TRACE_DEBUG_DRAIN_INTERVAL_MS
+    #define TRACE_DEBUG_DRAIN_INTERVAL_MS 10
+  #endif
+
+  // Default period in ms at which the writer thread flushes the output when TRACE_DEBUG_ASYNC_WRITER is defined
+  #ifndef TRACE_DEBUG_FLUSH_INTERVAL_MS
+    #define TRACE_DEBUG_FLUSH_INTERVAL_MS 1000
+  #endif
+
+  // Number of traces waiting for the writer thread above which it is woken up before the end of the flush interval
+  #ifndef TRACE_DEBUG_WRITER_BATCH_SIZE
+    #define TRACE_DEBUG_WRITER_BATCH_SIZE 1024
+  #endif
+
+  // Number of bytes a trace keeps for the values copied when TRACE_DEBUG_DEFERRED_FORMAT is defined.
+  // Values not fitting are formatted by the traced thread.
+  #ifndef TRACE_DEBUG_DEFERRED_FORMAT_SIZE
+    #define TRACE_DEBUG_DEFERRED_FORMAT_SIZE 64
+  #endif
+
+  // Number of trace points of a measure (its start, its ADD_TRACE_PERFORMANCE and its end) stored without allocation.
+  // A measure having more trace points moves them to the heap.
+  #ifndef TRACE_DEBUG_INLINE_TIMINGS
+    #define TRACE_DEBUG_INLINE_TIMINGS 4
+  #endif
+
+  // Size in bytes of the circular buffer of the file written when TRACE_DEBUG_MAPPED_OUTPUT is defined
+  #ifndef TRACE_DEBUG_MAPPED_OUTPUT_SIZE
+    #define TRACE_DEBUG_MAPPED_OUTPUT_SIZE (16 * 1024 * 1024)
+  #endif
+
+  // Number of call sites displayed by TraceDebug::Finalize when TRACE_DEBUG_CALL_TREE is defined
+  #ifndef TRACE_DEBUG_CALL_TREE_TOP
+    #define TRACE_DEBUG_CALL_TREE_TOP 20
+  #endif
+
+  // Duration in ms during which the time stamp counter is compared to std::chrono::steady_clock when TRACE_DEBUG_USE_TSC
+  // is defined. It is done once, when the program starts.
+  #ifndef TRACE_DEBUG_TSC_CALIBRATION_MS
+    #define TRACE_DEBUG_TSC_CALIBRATION_MS 10
+  #endif
+
 
 // =============================================================================================
 
-  #ifdef ENABLE_THREAD_SAFE
+  // Number of shards of each TRACE_COUNTER and TRACE_GAUGE: threads are spread over them so that they rarely update the
+  // same cache line
+  #ifndef TRACE_DEBUG_COUNTER_SHARDS
+    #define TRACE_DEBUG_COUNTER_SHARDS 16
+  #endif
+
+  // Number of traces each thread keeps when TRACE_DEBUG_FLIGHT_RECORDER is defined
+  #ifndef TRACE_DEBUG_FLIGHT_RECORDER_SIZE
+    #define TRACE_DEBUG_FLIGHT_RECORDER_SIZE 256
+  #endif
+
+  // Minimum time in ms between two dumps of the traces for the same call site when TRACE_DEBUG_FLIGHT_RECORDER is defined
+  #ifndef TRACE_DEBUG_FLIGHT_RECORDER_DUMP_INTERVAL_MS
+    #define TRACE_DEBUG_FLIGHT_RECORDER_DUMP_INTERVAL_MS 1000
+  #endif
+
+  // Number of threads whose scopes in progress are displayed by the signal handler when TRACE_DEBUG_SIGNAL_HANDLER is defined
+  #ifndef TRACE_DEBUG_SIGNAL_MAX_THREADS
+    #define TRACE_DEBUG_SIGNAL_MAX_THREADS 256
+  #endif
+
+  // Size in bytes above which the text log is continued in a new segment when TRACE_DEBUG_ROTATE_OUTPUT is defined
+  #ifndef TRACE_DEBUG_ROTATE_SIZE
+    #define TRACE_DEBUG_ROTATE_SIZE (64 * 1024 * 1024)
+  #endif
+
+  // Age in seconds after which the text log is continued in a new segment when TRACE_DEBUG_ROTATE_OUTPUT is defined (0: never)
+  #ifndef TRACE_DEBUG_ROTATE_INTERVAL_S
+    #define TRACE_DEBUG_ROTATE_INTERVAL_S 0
+  #endif
+
+  // Number of closed segments kept when TRACE_DEBUG_ROTATE_OUTPUT is defined: older segments are deleted
+  #ifndef TRACE_DEBUG_ROTATE_SEGMENTS
+    #define TRACE_DEBUG_ROTATE_SEGMENTS 8
+  #endif
+
+  #if defined(TRACE_DEBUG_COMPRESS_OUTPUT) && !defined(TRACE_DEBUG_ROTATE_OUTPUT)
+    #define TRACE_DEBUG_ROTATE_OUTPUT
+  #endif
+
+  // The intervals are measured by the statistics of the measures
+  #if defined(TRACE_DEBUG_TIME_SERIES) && !defined(TRACE_DEBUG_AGGREGATE_STATISTICS)
+    #define TRACE_DEBUG_AGGREGATE_STATISTICS
+  #endif
+
+  #if defined(TRACE_DEBUG_LOCK_FREE) && !defined(ENABLE_THREAD_SAFE)
+    #error "TRACE_DEBUG_LOCK_FREE requires ENABLE_THREAD_SAFE"
+  #endif
+
+  #if defined(TRACE_DEBUG_TIME_SERIES) && !defined(ENABLE_THREAD_SAFE)
+    #error "TRACE_DEBUG_TIME_SERIES requires ENABLE_THREAD_SAFE: the statistics are read by another thread"
+  #endif
+
+  #if defined(ENABLE_THREAD_SAFE) && !defined(TRACE_DEBUG_LOCK_FREE)
+    #define TRACE_DEBUG_USE_GLOBAL_MUTEX
+  #endif
+
+  // The thread draining the lock free buffers is the writer thread.
+  // The writer thread also switches the log segments: traced threads never wait for a rotation
+  #if (defined(TRACE_DEBUG_LOCK_FREE) || defined(TRACE_DEBUG_ROTATE_OUTPUT)) && !defined(TRACE_DEBUG_ASYNC_WRITER)
+    #define TRACE_DEBUG_ASYNC_WRITER
+  #endif
+
+  #if defined(TRACE_DEBUG_BINARY_OUTPUT) && defined(TRACE_DEBUG_CHROME_TRACE)
+    #error "TRACE_DEBUG_BINARY_OUTPUT and TRACE_DEBUG_CHROME_TRACE cannot be both defined"
+  #endif
+
+  // Traces are serialized into a file which is not a text log
+  #if defined(TRACE_DEBUG_BINARY_OUTPUT) || defined(TRACE_DEBUG_CHROME_TRACE)
+    #define TRACE_DEBUG_STRUCTURED_OUTPUT
+  #endif
+
+  #if defined(TRACE_DEBUG_MAPPED_OUTPUT) && defined(TRACE_DEBUG_STRUCTURED_OUTPUT)
+    #error "TRACE_DEBUG_MAPPED_OUTPUT only writes text traces: traces overwritten could not be decoded"
+  #endif
+
+  #if defined(TRACE_DEBUG_ROTATE_OUTPUT) && (defined(TRACE_DEBUG_STRUCTURED_OUTPUT) || defined(TRACE_DEBUG_MAPPED_OUTPUT))
+    #error "TRACE_DEBUG_ROTATE_OUTPUT only splits text logs, not binary, Chrome trace or memory mapped files"
+  #endif
+
+  #if (defined(TRACE_DEBUG_STRUCTURED_OUTPUT) || defined(TRACE_DEBUG_MAPPED_OUTPUT) || defined(TRACE_DEBUG_ROTATE_OUTPUT)) && \
+      !defined(WRITE_OUTPUT_TO_FILE)
+    #define WRITE_OUTPUT_TO_FILE
+  #endif
+
+  // Protects the trace bookkeeping: not needed when each thread owns its own state
+  #ifdef TRACE_DEBUG_USE_GLOBAL_MUTEX
     #define GET_THREAD_SAFE_GUARD std::lock_guard<std::recursive_mutex> guard(the_mutex);
   #else
     #define GET_THREAD_SAFE_GUARD
   #endif
 
+  // Protects the cache and the output
+  #ifdef ENABLE_THREAD_SAFE
+    #define GET_OUTPUT_GUARD std::lock_guard<std::recursive_mutex> guard(the_mutex);
+  #else
+    #define GET_OUTPUT_GUARD
+  #endif
+
+  #ifdef TRACE_DEBUG_LOCK_FREE
+    #define TRACE_DEBUG_PER_THREAD thread_local
+  #else
+    #define TRACE_DEBUG_PER_THREAD
+  #endif
+
+  #if defined(TRACE_DEBUG_SIGNAL_HANDLER) && !defined(_WIN32)
+    #define TRACE_DEBUG_SIGNAL_DUMP
+    // STDERR_FILENO
+    #include <unistd.h>
+  #endif
+
+  #if defined(TRACE_DEBUG_USE_PERF_COUNTERS) && defined(__linux__)
+    #define TRACE_DEBUG_PERF_COUNTERS
+  #endif
+
+  #if defined(TRACE_DEBUG_USE_TSC) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+    #define TRACE_DEBUG_TSC_CLOCK
+    #ifdef _MSC_VER
+      #include <intrin.h>
+    #else
+      #include <x86intrin.h>
+    #endif
+  #endif
+
   #ifdef UNIT_TRACE_DEBUG_NANO
     #define UNIT_TRACE_DEBUG "ns"
     #define UNIT_TRACE_TEMPLATE_TYPE std::nano
@@ -86,24 +341,77 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
     #ifdef USE_QT_DEBUG
       #include <QDebug>
       #include <QBuffer>
-      #define PRINT_RESULT(string_to_print) TraceDebug::WriteToFile(string_to_print, "TraceDebugQt");
+      #define TRACE_DEBUG_OUTPUT_FILE_NAME "TraceDebugQt"
     #else
-      #define PRINT_RESULT(string_to_print) TraceDebug::WriteToFile(string_to_print, "TraceDebug");
+      #define TRACE_DEBUG_OUTPUT_FILE_NAME "TraceDebug"
     #endif
+    #define PRINT_RESULT(string_to_print) TraceDebug::WriteToFile(string_to_print, TRACE_DEBUG_OUTPUT_FILE_NAME);
   #endif
 
   // =============================================================================================
 
   #ifdef _WIN32
     #define __func__ __FUNCTION__
-    #define __FILENAME__ (strrchr(__FILE__, '\\') ? strrchr(__FILE__, '\\') + 1 : __FILE__)
-  #else
-    #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
   #endif
 
+  // Returns the file name without its directories, evaluated at compile time when possible
+  constexpr const char* TraceDebugBaseName(const char* path, const char* baseName) {
+    return *path == '\0' ? baseName
+         : (*path == '/' || *path == '\\') ? TraceDebugBaseName(path + 1, path + 1)
+         : TraceDebugBaseName(path + 1, baseName);
+  }
+  constexpr const char* TraceDebugBaseName(const char* path) {
+    return TraceDebugBaseName(path, path);
+  }
+  #define __FILENAME__ TraceDebugBaseName(__FILE__)
+
   #define TOKENPASTE(x, y) x ## y
   #define TOKENPASTE_EXPAND(x, y) TOKENPASTE(x , y)
 
+  // Describes a trace macro expansion. It is created once per expansion, traces only carry its address
+  #define TRACE_DEBUG_CALL_SITE(callSiteName, fileName, label) \
+    static const TraceDebugCallSite callSiteName(__func__, __FILENAME__, fileName, __LINE__, label);
+  #define TRACE_DEBUG_LOCK_CALL_SITE(callSiteName, label) \
+    static const TraceDebugCallSite callSiteName(__func__, __FILENAME__, __FILENAME__, __LINE__, label, TraceDebugCallSiteKind::Lock);
+  // Getter of the call site of a traced mutex, usable in a member initializer
+  #define TRACE_DEBUG_LOCK_SITE(label) \
+    []() -> const TraceDebugCallSite& { \
+      static const TraceDebugCallSite lockSite("", __FILENAME__, __FILENAME__, __LINE__, label, TraceDebugCallSiteKind::Lock); \
+      return lockSite; \
+    }
+  // Call site of a task submission, usable in an expression
+  #define TRACE_DEBUG_TASK_SITE(label) \
+    ([](const char* functionName) -> const TraceDebugCallSite& { \
+      static const TraceDebugCallSite taskSite(functionName, __FILENAME__, __FILENAME__, __LINE__, label, \
+                                               TraceDebugCallSiteKind::Task); \
+      return taskSite; \
+    }(__func__))
+
+  // Until the end of the scope, the allocations of the thread are TraceDebug's own ones
+  #ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+    #define TRACE_DEBUG_IGNORE_ALLOCATIONS \
+      TraceDebugAllocationCounter::Ignore TOKENPASTE_EXPAND(__UnusedIgnoredAllocations, __LINE__)
+  #else
+    #define TRACE_DEBUG_IGNORE_ALLOCATIONS
+  #endif
+
+  // Streams a value (or several values separated by <<) into a trace of the given call site
+  #ifdef TRACE_DEBUG_DEFERRED_FORMAT
+    #define TRACE_DEBUG_PRINT_VALUE(kind, callSite, streamedValue) { \
+      TRACE_DEBUG_IGNORE_ALLOCATIONS; \
+      TraceDebugDeferredValue TOKENPASTE_EXPAND(__UnusedValue, __LINE__);\
+      TOKENPASTE_EXPAND(__UnusedValue, __LINE__) << streamedValue; \
+      TraceDebug::PrintEvent(kind, callSite, std::move(TOKENPASTE_EXPAND(__UnusedValue, __LINE__)));\
+    }
+  #else
+    #define TRACE_DEBUG_PRINT_VALUE(kind, callSite, streamedValue) { \
+      TRACE_DEBUG_IGNORE_ALLOCATIONS; \
+      std::stringstream TOKENPASTE_EXPAND(__UnusedStream, __LINE__);\
+      TOKENPASTE_EXPAND(__UnusedStream, __LINE__) << streamedValue; \
+      TraceDebug::PrintEvent(kind, callSite, TOKENPASTE_EXPAND(__UnusedStream, __LINE__).str());\
+    }
+  #endif
+
 // =============================================================================================
 
   // Activate traces
@@ -115,53 +423,52 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
   // the filename, line number and function name are all displayed.
   // This macro should be used when deeper hierachy will be created to compute the expected value.
 #define DISPLAY_DEBUG_VALUE(value) \
-  TraceDebug TOKENPASTE_EXPAND(__Unused, __LINE__)(__func__, __FILENAME__, __LINE__); \
-  if(TraceDebug::IsTraceActive()) { \
-    std::stringstream TOKENPASTE_EXPAND(__UnusedStream1, __LINE__);\
-    std::stringstream TOKENPASTE_EXPAND(__UnusedStream2, __LINE__);\
-    TOKENPASTE_EXPAND(__UnusedStream1, __LINE__) << TraceDebug::GetDiffTimeSinceStartAndThreadId() << ":Processing " << #value << "  From " << __FILENAME__ << ":" << __LINE__ << " ("<< __func__ << ")"; \
-    TraceDebug::PrintString(TOKENPASTE_EXPAND(__UnusedStream1, __LINE__).str(), true);\
-    TOKENPASTE_EXPAND(__UnusedStream2, __LINE__) << TraceDebug::GetDiffTimeSinceStartAndThreadId() << ":->" << __FILENAME__ << ":" << __LINE__ << " ("<< __func__ << ")  " << #value << " = " << (value); \
-    TraceDebug::PrintString(TOKENPASTE_EXPAND(__UnusedStream2, __LINE__).str(), true);\
+  TRACE_DEBUG_CALL_SITE(TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__), __FILENAME__, #value) \
+  TraceDebug TOKENPASTE_EXPAND(__Unused, __LINE__)(TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__)); \
+  if(TOKENPASTE_EXPAND(__Unused, __LINE__).IsTraced() && TraceDebug::IsTraceActive()) { \
+    TraceDebug::PrintEvent(TraceDebugEventKind::ProcessingValue, TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__), std::string());\
+    TRACE_DEBUG_PRINT_VALUE(TraceDebugEventKind::Value, TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__), (value)); \
   }
   // Display a value specifying the expression, its value and many blank spaces defining the deepness of the hierarchy,
   // the filename, line number and function name are all displayed.
   // This macro should be used when NO deeper hierachy is required to compute the expected value.
 #define DISPLAY_IMMEDIATE_DEBUG_VALUE(value) \
-  TraceDebug TOKENPASTE_EXPAND(__Unused, __LINE__)(__func__, __FILENAME__, __LINE__); \
-  if(TraceDebug::IsTraceActive()) { \
-    std::stringstream TOKENPASTE_EXPAND(__UnusedStream, __LINE__);\
-    TOKENPASTE_EXPAND(__UnusedStream, __LINE__) << TraceDebug::GetDiffTimeSinceStartAndThreadId() << ":" << __FILENAME__ << ":" << __LINE__ << " ("<< __func__ << ")  " << #value << " = " << (value); \
-    TraceDebug::PrintString(TOKENPASTE_EXPAND(__UnusedStream, __LINE__).str(), true);\
+  TRACE_DEBUG_CALL_SITE(TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__), __FILENAME__, #value) \
+  TraceDebug TOKENPASTE_EXPAND(__Unused, __LINE__)(TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__)); \
+  if(TOKENPASTE_EXPAND(__Unused, __LINE__).IsTraced() && TraceDebug::IsTraceActive()) { \
+    TRACE_DEBUG_PRINT_VALUE(TraceDebugEventKind::ImmediateValue, TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__), (value)); \
   }
 #ifdef USE_QT_DEBUG
 #define DISPLAY_IMMEDIATE_DEBUG_QT_VALUE(value) DISPLAY_IMMEDIATE_DEBUG_VALUE(TraceDebug::QtToString(value))
 #endif
   // Display a message and preceeded by blank spaces defining the deepness of the hierarchy
   #define DISPLAY_DEBUG_MESSAGE(message) { \
-      TraceDebug TOKENPASTE_EXPAND(__Unused, __LINE__)(__func__, __FILENAME__, __LINE__); \
-      std::stringstream TOKENPASTE_EXPAND(__UnusedStream, __LINE__);\
-      TOKENPASTE_EXPAND(__UnusedStream, __LINE__) << TraceDebug::GetDiffTimeSinceStartAndThreadId() << ":" << __FILENAME__ << ":" << __LINE__ << " ("<< __func__ << ")  " << message; \
-      if(TraceDebug::IsTraceActive()) { TraceDebug::PrintString(TOKENPASTE_EXPAND(__UnusedStream, __LINE__).str(), true); }\
+      TRACE_DEBUG_CALL_SITE(TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__), __FILENAME__, "") \
+      TraceDebug TOKENPASTE_EXPAND(__Unused, __LINE__)(TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__)); \
+      if(TOKENPASTE_EXPAND(__Unused, __LINE__).IsTraced() && TraceDebug::IsTraceActive()) { \
+        TRACE_DEBUG_PRINT_VALUE(TraceDebugEventKind::Message, TOKENPASTE_EXPAND(__UnusedCallSite, __LINE__), message); \
+      }\
   }
   // Display a value specifying the expression, its value and preceed them with blank spaces defining the deepness of the hierarchy
   // deeper hierarchy will however not be displayed
   #define DISPLAY_DEBUG_VALUE_NON_HIERARCHICALLY(value) \
-      TraceDebug TOKENPASTE_EXPAND(__Unused_Debug, __LINE__)(__func__, __FILENAME__, __LINE__); \
-      if(TraceDebug::IsTraceActive()) { \
+      TRACE_DEBUG_CALL_SITE(TOKENPASTE_EXPAND(__Unused_DebugCallSite, __LINE__), __BASE_FILE__, #value) \
+      TraceDebug TOKENPASTE_EXPAND(__Unused_Debug, __LINE__)(TOKENPASTE_EXPAND(__Unused_DebugCallSite, __LINE__)); \
+      if(TOKENPASTE_EXPAND(__Unused_Debug, __LINE__).IsTraced() && TraceDebug::IsTraceActive()) { \
         DISPLAY_DEBUG_DEACTIVE_TRACE; \
-        std::stringstream TOKENPASTE_EXPAND(__UnusedStream, __LINE__);\
-        TOKENPASTE_EXPAND(__UnusedStream, __LINE__) << TraceDebug::GetDiffTimeSinceStartAndThreadId() << ":" << __BASE_FILE__ << ":" << __LINE__ << " ("<< __func__ << ")  " << #value << " = " << (value) << std::endl; \
-        TraceDebug::PrintString(TOKENPASTE_EXPAND(__UnusedStream, __LINE__).str(), true);\
+        TRACE_DEBUG_PRINT_VALUE(TraceDebugEventKind::ImmediateValue, TOKENPASTE_EXPAND(__Unused_DebugCallSite, __LINE__), (value) << std::endl); \
         DISPLAY_DEBUG_ACTIVE_TRACE; \
       }
   // This macro will display the full time between the point it is created to its end of scope.    
   #define START_TRACE_PERFORMANCE(unique_key) \
-    TraceDebug TOKENPASTE_EXPAND(unique_key, _Performance_Variable)(__func__, __FILENAME__, __LINE__, #unique_key);
+    TRACE_DEBUG_CALL_SITE(TOKENPASTE_EXPAND(unique_key, _Performance_CallSite), __FILENAME__, #unique_key) \
+    TraceDebug TOKENPASTE_EXPAND(unique_key, _Performance_Variable)(TOKENPASTE_EXPAND(unique_key, _Performance_CallSite), true);
   // this macro allows to create several measurement points between START_TRACE_PERFORMANCE creation and its end of scope
   #define ADD_TRACE_PERFORMANCE(unique_key, userInfo) \
-    auto TOKENPASTE_EXPAND(unique_key, __LINE__) = std::chrono::steady_clock::now();\
-    TOKENPASTE_EXPAND(unique_key, _Performance_Variable).AddTrace(TOKENPASTE_EXPAND(unique_key, __LINE__), userInfo);
+    if(TOKENPASTE_EXPAND(unique_key, _Performance_Variable).IsTraced()) { \
+      TRACE_DEBUG_IGNORE_ALLOCATIONS; \
+      TOKENPASTE_EXPAND(unique_key, _Performance_Variable).AddTrace(TraceDebugClock::Now(), userInfo); \
+    }
   // Define deepness of cache: Set below 2, caching is deactivated: all results are displayed when available.
   // Displaying has a huge cost of performance, thus enabling the cache allows to have a more reliable measure.
   // Once the cache is full it is displayed and all measures not yet done will notify the inducted time overhead.
@@ -172,57 +479,958 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
   // only the diff time in a scope will be displayed.
   #define DISPLAY_START_TRACE_PERFORMANCE(displayStartTracePerformance) \
     TraceDebug::DisplayStartTracePerformance(displayStartTracePerformance);
+  // Defines in ms how often the writer thread flushes the output when TRACE_DEBUG_ASYNC_WRITER is defined.
+  // The output is always flushed by TraceDebug::Finalize.
+  #define SET_TRACE_OUTPUT_FLUSH_INTERVAL(flushIntervalMs) \
+    TraceDebug::SetOutputFlushInterval(flushIntervalMs);
+  // Displays the statistics of all START_TRACE_PERFORMANCE when TRACE_DEBUG_AGGREGATE_STATISTICS is defined, and
+  // how many traces were skipped by sampling. They are also displayed by TraceDebug::Finalize.
+  #define PRINT_TRACE_PERFORMANCE_STATISTICS \
+    TraceDebug::PrintStatistics();
+  // Only does some of the traces of the call sites whose label (unique key or expression), function name, file name
+  // or "fileName:lineNumber" matches callSiteName (wildcards * and ?), e.g.
+  // SET_TRACE_SAMPLING("hotPath", TraceDebugSampling::OneIn(100)).
+  // Applies to the call sites already used and to the next ones.
+  #define SET_TRACE_SAMPLING(callSiteName, sampling) \
+    TraceDebug::SetSampling(callSiteName, sampling);
+  // Enables or disables the call sites matching callSiteName as SET_TRACE_SAMPLING does, e.g. SET_TRACE_ENABLED("*.cpp", false).
+  // The environment variable TRACE_DEBUG_ENABLE sets rules read at startup, e.g. TRACE_DEBUG_ENABLE="-*,+Parser*.cpp,+hotPath".
+  // A disabled call site costs a single branch.
+  #define SET_TRACE_ENABLED(callSiteName, enabled) \
+    TraceDebug::SetEnabled(callSiteName, enabled);
+  // Locks mutex until the end of the scope as std::lock_guard does, measuring the time waited for it and the time it was held.
+  // They are displayed as a START_TRACE_PERFORMANCE of this line: "<Locked> - <Lock>" is the wait, "<Unlocked> - <Locked>" the hold
+  #define TRACE_LOCK_GUARD(mutex) \
+    TRACE_DEBUG_LOCK_CALL_SITE(TOKENPASTE_EXPAND(__UnusedLockSite, __LINE__), #mutex) \
+    TraceDebugLockGuard<decltype(mutex)> TOKENPASTE_EXPAND(__UnusedLock, __LINE__)(mutex, TOKENPASTE_EXPAND(__UnusedLockSite, __LINE__));
+  // Same as TRACE_LOCK_GUARD locking the shared side of mutex as std::shared_lock does
+  #define TRACE_SHARED_LOCK_GUARD(mutex) \
+    TRACE_DEBUG_LOCK_CALL_SITE(TOKENPASTE_EXPAND(__UnusedLockSite, __LINE__), #mutex) \
+    TraceDebugLockGuard<decltype(mutex), true> TOKENPASTE_EXPAND(__UnusedLock, __LINE__)(mutex, TOKENPASTE_EXPAND(__UnusedLockSite, __LINE__));
+  // Declares a mutex of type mutexType (std::mutex, std::recursive_mutex...) measuring all its acquisitions, e.g. as a member
+  // TRACED_MUTEX(std::mutex, queueMutex); All the mutexes declared by the same line share their statistics
+  #define TRACED_MUTEX(mutexType, name) \
+    TraceDebugMutex<mutexType> name{TRACE_DEBUG_LOCK_SITE(#name)}
+  // Same as TRACED_MUTEX for std::shared_timed_mutex or std::shared_mutex
+  #define TRACED_SHARED_MUTEX(sharedMutexType, name) \
+    TraceDebugSharedMutex<sharedMutexType> name{TRACE_DEBUG_LOCK_SITE(#name)}
+  // Same as std::async, the traces of the task being nested in the ones in progress where TRACE_ASYNC is called, e.g.
+  // auto result = TRACE_ASYNC(std::launch::async, f1);
+  // The time the task waited before it started is measured: "<Started> - <Submitted>"
+  #define TRACE_ASYNC(...) \
+    TraceDebugAsync(TraceDebug::CaptureContext(TRACE_DEBUG_TASK_SITE("async")), __VA_ARGS__)
+  // Captures the hierarchy of the traces in progress, to be given with a task to another thread (a thread pool...) which
+  // restores it with TRACE_RESTORE_CONTEXT, e.g.
+  // pool.Submit([context = TRACE_CAPTURE_CONTEXT]() { TRACE_RESTORE_CONTEXT(context); ... });
+  #define TRACE_CAPTURE_CONTEXT \
+    TraceDebug::CaptureContext(TRACE_DEBUG_TASK_SITE("context"))
+  // Until the end of the scope the traces are nested in the ones in progress when the context was captured
+  #define TRACE_RESTORE_CONTEXT(context) \
+    TraceDebugContextScope TOKENPASTE_EXPAND(__UnusedContext, __LINE__)(context);
+  // Adds increment to the counter name (a string), e.g. TRACE_COUNTER("bytesSent", size). An update is a relaxed atomic addition
+  // to a shard of the counter: it never waits for another thread. Counters are displayed with the statistics
+  #define TRACE_COUNTER(name, increment) { \
+      static TraceDebugCounter& TOKENPASTE_EXPAND(__UnusedCounter, __LINE__) = TraceDebug::GetCounter(name, false); \
+      TOKENPASTE_EXPAND(__UnusedCounter, __LINE__).Add(increment); \
+    }
+  // Same as TRACE_COUNTER for a level that goes up and down, e.g. TRACE_GAUGE("queueSize", 1) on push and
+  // TRACE_GAUGE("queueSize", -1) on pop. The level is the sum of the deltas
+  #define TRACE_GAUGE(name, delta) { \
+      static TraceDebugCounter& TOKENPASTE_EXPAND(__UnusedGauge, __LINE__) = TraceDebug::GetCounter(name, true); \
+      TOKENPASTE_EXPAND(__UnusedGauge, __LINE__).Add(delta); \
+    }
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  // Outputs the last traces of the thread when a START_TRACE_PERFORMANCE of the call sites matching callSiteName (as
+  // SET_TRACE_SAMPLING does) lasts more than threshold (a std::chrono duration), e.g.
+  // SET_TRACE_SLOW_THRESHOLD("hotPath", std::chrono::microseconds(500)). A threshold of 0 never outputs them.
+  #define SET_TRACE_SLOW_THRESHOLD(callSiteName, threshold) \
+    TraceDebug::SetSlowThreshold(callSiteName, std::chrono::duration_cast<std::chrono::nanoseconds>(threshold));
+#else
+  #define SET_TRACE_SLOW_THRESHOLD(callSiteName, threshold)
+#endif
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+  // Writes the traces not written yet and the scopes in progress into fileDescriptor (e.g. STDERR_FILENO or a file opened
+  // beforehand) when the program receives SIGSEGV, SIGABRT, SIGBUS or SIGFPE. The previous handler is called afterwards.
+  #define TRACE_INSTALL_SIGNAL_HANDLER(fileDescriptor) \
+    TraceDebug::InstallSignalHandler(fileDescriptor);
+#else
+  #define TRACE_INSTALL_SIGNAL_HANDLER(fileDescriptor)
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+  // Writes into fileName, every intervalMs, the statistics of the measures done during the interval: one line per segment in CSV,
+  // or one line per interval when fileName ends with .jsonl, e.g. START_TRACE_TIME_SERIES("latency.csv", 1000).
+  // The file is truncated first, an interval of 0 stops writing
+  #define START_TRACE_TIME_SERIES(fileName, intervalMs) \
+    TraceDebug::StartTimeSeries(fileName, intervalMs);
+#else
+  #define START_TRACE_TIME_SERIES(fileName, intervalMs)
+#endif
+#ifdef TRACE_DEBUG_CALL_TREE
+  // Displays the topCount call sites of highest self time (time not spent in a nested START_TRACE_PERFORMANCE)
+  #define PRINT_TRACE_CALL_TREE(topCount) \
+    TraceDebug::PrintCallTree(topCount);
+  // Writes the call tree as folded stacks ("caller;callee selfTimeInNs" lines) read by flamegraph.pl or speedscope
+  #define WRITE_TRACE_FOLDED_STACKS(fileName) \
+    TraceDebug::WriteFoldedStacks(fileName);
+#else
+  #define PRINT_TRACE_CALL_TREE(topCount)
+  #define WRITE_TRACE_FOLDED_STACKS(fileName)
+#endif
+
+  // What a trace displays
+  enum class TraceDebugEventKind : unsigned char {
+    Text,             // Free text
+    StartMeasure,     // START_TRACE_PERFORMANCE constructed
+    EndMeasure,       // START_TRACE_PERFORMANCE results
+    ProcessingValue,  // DISPLAY_DEBUG_VALUE before evaluating the value
+    Value,            // DISPLAY_DEBUG_VALUE result
+    ImmediateValue,   // DISPLAY_IMMEDIATE_DEBUG_VALUE
+    Message           // DISPLAY_DEBUG_MESSAGE
+  };
+
+  // Time source of all traces: the time displayed and the measured durations come from the same ticks.
+  // Ticks are converted to ns only where traces are written.
+  class TraceDebugClock {
+    public:
+      typedef long long Ticks;
+
+      static Ticks Now() {
+#ifdef TRACE_DEBUG_TSC_CLOCK
+        // Unlike rdtsc, waits for the previous instructions: the end of a measure is not read too early
+        unsigned int processor;
+        return static_cast<Ticks>(__rdtscp(&processor));
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+      }
+      // Duration in ns of a difference of ticks
+      static long long ToNanoseconds(Ticks ticks);
+      static Ticks FromNanoseconds(long long nanoseconds);
+      // Time since epoch in ns of a value returned by Now
+      static long long ToEpochNanoseconds(Ticks ticks);
+
+    private:
+      struct Calibration {
+        Ticks startTicks;
+        long long startEpochNanoseconds;
+        double nanosecondsPerTick;
+      };
+      // Done once, on first use
+      static const Calibration& GetCalibration();
+  };
+
+  // Which traces of a call site are done
+  struct TraceDebugSampling {
+    enum class Mode : unsigned char { OneIn, Probability, PerSecond };
+    Mode mode = Mode::OneIn;
+    // OneIn: one trace out of period
+    unsigned long long period = 1;
+    // Probability: a random 64 bits number must be below threshold
+    unsigned long long threshold = 0;
+    // PerSecond: time between two traces and how much in advance a trace can be done
+    long long interval = 0;
+    long long tolerance = 0;
+
+    // The first trace and then one out of period traces
+    static TraceDebugSampling OneIn(unsigned long long period);
+    // Each trace is done with the given probability (between 0 and 1)
+    static TraceDebugSampling Probability(double probability);
+    // Token bucket: at most tracesPerSecond traces per second, all threads together
+    static TraceDebugSampling PerSecond(double tracesPerSecond);
+  };
+
+  // What a call site measures
+  enum class TraceDebugCallSiteKind : unsigned char {
+    Trace,  // Trace macro
+    Lock,   // Traced lock (TRACE_LOCK_GUARD, TRACED_MUTEX...)
+    Task    // Submission of a task to another thread (TRACE_ASYNC, TRACE_CAPTURE_CONTEXT)
+  };
+
+  // Static description of a trace macro expansion
+  struct TraceDebugCallSite {
+    const char* functionName;
+    // Displayed file name
+    const char* fileName;
+    int lineNumber;
+    // Unique key of START_TRACE_PERFORMANCE or displayed expression
+    const char* label;
+    // Index of this call site, given when it is registered
+    unsigned int id;
+    // Call sites of the same file and function share the same scope
+    unsigned int scopeId;
+    // Set by SetEnabled and TRACE_DEBUG_ENABLE, checked before anything else
+    mutable std::atomic<bool> enabled;
+    // Null when all the traces are done
+    mutable std::atomic<const TraceDebugSampling*> sampling;
+    // TraceDebugSampling::PerSecond: time from which the next trace can be done
+    mutable std::atomic<long long> nextSampleTime;
+    // Traces not done because of sampling, each thread adds them by batches
+    mutable std::atomic<unsigned long long> skippedCalls;
+    TraceDebugCallSiteKind kind;
+    // Lock sites: acquisitions which had to wait for another owner
+    mutable std::atomic<unsigned long long> contentions;
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+    // Duration above which the traces of the thread are output, 0 when they never are
+    mutable std::atomic<long long> slowThreshold;
+    // Time from which the traces can be output again, and slow calls not output since then
+    mutable std::atomic<long long> nextDumpTime;
+    mutable std::atomic<unsigned long long> undumpedSlowCalls;
+#endif
+    TraceDebugCallSite(const char* functionName, const char* scopeFileName, const char* fileName, int lineNumber, const char* label,
+                       TraceDebugCallSiteKind kind = TraceDebugCallSiteKind::Trace);
+  };
+
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+  // Values copied by a DISPLAY_* macro: each value is a type followed by its bytes
+  struct TraceDebugArguments {
+    enum Type : unsigned char { Signed, Unsigned, FloatingPoint, Boolean, Character, String };
+    unsigned char data[TRACE_DEBUG_DEFERRED_FORMAT_SIZE];
+    unsigned short size = 0;
+
+    // Returns false when the value does not fit
+    bool Append(Type type, const void* value, size_t valueSize);
+    // Formats the values as std::ostream would have done
+    void Format(std::ostream& stream) const;
+  };
+
+  // Collects the values of a DISPLAY_* macro. Values that cannot be copied, or do not fit anymore, are formatted into text
+  class TraceDebugDeferredValue {
+    public:
+      TraceDebugArguments arguments;
+
+      // Values formatted by the traced thread, displayed after the arguments
+      std::string GetText() const { return stream ? stream->str() : std::string(); }
+
+      template <typename T>
+      typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, TraceDebugDeferredValue&>::type
+      operator<<(T value) { long long copy = value; return Append(TraceDebugArguments::Signed, &copy, sizeof(copy), value); }
+      template <typename T>
+      typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, TraceDebugDeferredValue&>::type
+      operator<<(T value) { unsigned long long copy = value; return Append(TraceDebugArguments::Unsigned, &copy, sizeof(copy), value); }
+      template <typename T>
+      typename std::enable_if<std::is_floating_point<T>::value, TraceDebugDeferredValue&>::type
+      operator<<(T value) { double copy = value; return Append(TraceDebugArguments::FloatingPoint, &copy, sizeof(copy), value); }
+      TraceDebugDeferredValue& operator<<(bool value) { return Append(TraceDebugArguments::Boolean, &value, sizeof(value), value); }
+      TraceDebugDeferredValue& operator<<(char value) { return Append(TraceDebugArguments::Character, &value, sizeof(value), value); }
+      TraceDebugDeferredValue& operator<<(signed char value) { return *this << static_cast<char>(value); }
+      TraceDebugDeferredValue& operator<<(unsigned char value) { return *this << static_cast<char>(value); }
+      TraceDebugDeferredValue& operator<<(const char* value) { return AppendString(value, std::strlen(value)); }
+      TraceDebugDeferredValue& operator<<(const std::string& value) { return AppendString(value.data(), value.size()); }
+      // Manipulators (std::endl, std::hex, std::setw ...) and any other type are formatted now
+      TraceDebugDeferredValue& operator<<(std::ostream& (*manipulator)(std::ostream&)) { return Format(manipulator); }
+      TraceDebugDeferredValue& operator<<(std::ios_base& (*manipulator)(std::ios_base&)) { return Format(manipulator); }
+      template <typename T>
+      typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_convertible<const T&, const char*>::value &&
+                              !std::is_convertible<const T&, const std::string&>::value, TraceDebugDeferredValue&>::type
+      operator<<(const T& value) { return Format(value); }
+
+    private:
+      // Created by the first value formatted now: the next values are formatted into it too, to keep their order and the
+      // state set by the manipulators
+      std::unique_ptr<std::ostringstream> stream;
+
+      template <typename T>
+      TraceDebugDeferredValue& Append(TraceDebugArguments::Type type, const void* copy, size_t copySize, const T& value) {
+        if(stream || !arguments.Append(type, copy, copySize)) {
+          return Format(value);
+        }
+        return *this;
+      }
+      TraceDebugDeferredValue& AppendString(const char* value, size_t length) {
+        if(stream || !arguments.Append(TraceDebugArguments::String, value, length)) {
+          GetStream().write(value, static_cast<std::streamsize>(length));
+        }
+        return *this;
+      }
+      template <typename T>
+      TraceDebugDeferredValue& Format(const T& value) {
+        GetStream() << value;
+        return *this;
+      }
+      std::ostream& GetStream() {
+        if(!stream) {
+          stream.reset(new std::ostringstream);
+        }
+        return *stream;
+      }
+  };
+#endif
+
+  // Trace point of a START_TRACE_PERFORMANCE
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+  // Values of the performance counters of a thread
+  struct TraceDebugCounters {
+    static const unsigned int count = 4;
+    unsigned long long values[count];
+  };
+
+  // Performance counters of the current thread, opened with perf_event_open on first use: cycles, instructions, cache
+  // misses and branch misses, or task clock, page faults, context switches and CPU migrations when the kernel refuses
+  // hardware events. Hardware counters are read with rdpmc when the kernel allows it, with a single read otherwise
+  class TraceDebugPerfCounters {
+    public:
+      // Values are 0 when no counter could be opened
+      static void Read(TraceDebugCounters& counters);
+      // Null when no counter could be opened
+      static const char* GetName(unsigned int index);
+  };
+#endif
+
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+  // Heap allocations of a thread
+  struct TraceDebugAllocations {
+    unsigned long long count;
+    unsigned long long bytes;
+  };
+
+  // Reads the allocations counted by the global operator new of TraceDebug.cpp
+  class TraceDebugAllocationCounter {
+    public:
+      static void Read(TraceDebugAllocations& allocations);
+      // While an instance exists the allocations of the current thread are not counted
+      class Ignore {
+        public:
+          Ignore();
+          ~Ignore();
+          Ignore(const Ignore&) = delete;
+          Ignore& operator=(const Ignore&) = delete;
+      };
+  };
+#endif
+
+  struct TraceDebugTiming {
+    // String literal or interned label: never freed
+    const char* label = "";
+    TraceDebugClock::Ticks time = 0;
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+    // Cost of the traces done by the thread until this trace point
+    TraceDebugClock::Ticks overhead = 0;
+#endif
+#ifndef TRACE_DEBUG_ASYNC_WRITER
+    // Time spent by the thread printing the cache after this trace point, displayed before the label
+    TraceDebugClock::Ticks printingOverhead = 0;
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+    TraceDebugCounters counters = TraceDebugCounters();
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+    TraceDebugAllocations allocations = TraceDebugAllocations();
+#endif
+  };
+
+  // Trace points of a measure: the first TRACE_DEBUG_INLINE_TIMINGS are stored inline, so that a measure and the event it is
+  // output by do not allocate
+  class TraceDebugTimings {
+    public:
+      TraceDebugTimings() = default;
+      TraceDebugTimings(size_t count, const TraceDebugTiming& timing) {
+        for(size_t index = 0; index < count; ++index) {
+          push_back(timing);
+        }
+      }
+      TraceDebugTimings(const TraceDebugTimings&) = default;
+      TraceDebugTimings& operator=(const TraceDebugTimings&) = default;
+      TraceDebugTimings(TraceDebugTimings&& other) noexcept { *this = std::move(other); }
+      TraceDebugTimings& operator=(TraceDebugTimings&& other) noexcept {
+        std::copy(other.inlineTimings, other.inlineTimings + std::min<size_t>(other.count, TRACE_DEBUG_INLINE_TIMINGS),
+                  inlineTimings);
+        heapTimings = std::move(other.heapTimings);
+        count = other.count;
+        other.clear();
+        return *this;
+      }
+
+      size_t size() const { return count; }
+      bool empty() const { return count == 0; }
+      TraceDebugTiming* begin() { return heapTimings.empty() ? inlineTimings : heapTimings.data(); }
+      const TraceDebugTiming* begin() const { return heapTimings.empty() ? inlineTimings : heapTimings.data(); }
+      TraceDebugTiming* end() { return begin() + count; }
+      const TraceDebugTiming* end() const { return begin() + count; }
+      TraceDebugTiming& operator[](size_t index) { return begin()[index]; }
+      const TraceDebugTiming& operator[](size_t index) const { return begin()[index]; }
+      TraceDebugTiming& front() { return *begin(); }
+      const TraceDebugTiming& front() const { return *begin(); }
+      TraceDebugTiming& back() { return end()[-1]; }
+      const TraceDebugTiming& back() const { return end()[-1]; }
+
+      void push_back(const TraceDebugTiming& timing) {
+        if(count < TRACE_DEBUG_INLINE_TIMINGS) {
+          inlineTimings[count++] = timing;
+          return;
+        }
+        if(heapTimings.empty()) {
+          heapTimings.assign(inlineTimings, inlineTimings + count);
+        }
+        heapTimings.push_back(timing);
+        ++count;
+      }
+      // Keeps the heap capacity for the next measure
+      void clear() {
+        heapTimings.clear();
+        count = 0;
+      }
+
+    private:
+      TraceDebugTiming inlineTimings[TRACE_DEBUG_INLINE_TIMINGS];
+      // All the trace points once there are more than TRACE_DEBUG_INLINE_TIMINGS
+      std::vector<TraceDebugTiming> heapTimings;
+      size_t count = 0;
+  };
+
+  // Hierarchy of a thread when it submitted a task, see TRACE_CAPTURE_CONTEXT
+  struct TraceDebugContext {
+    // Null when the task site is disabled or sampled out: nothing is restored
+    const TraceDebugCallSite* callSite = nullptr;
+    // Unique id linking the submission to the task in the Chrome trace
+    unsigned long long id = 0;
+    std::thread::id threadId;
+    TraceDebugClock::Ticks submitTime = 0;
+    unsigned int deepness = 0;
+#ifdef TRACE_DEBUG_CALL_TREE
+    // Call site ids of the measures in progress in the submitting thread, outermost first
+    std::vector<unsigned int> callTreePath;
+#endif
+  };
+
+  // What EnterContext changed in the thread running a task
+  struct TraceDebugContextState {
+    unsigned int deepness = 0;
+#ifdef TRACE_DEBUG_CALL_TREE
+    unsigned int callTreeNodes = 0;
+    unsigned int previousContextDepth = 0;
+#endif
+  };
+
+  // One acquisition of a traced lock: waited from lockTime to lockedTime, held from lockedTime until unlocked
+  struct TraceDebugLockTimes {
+    TraceDebugClock::Ticks lockTime = 0;
+    TraceDebugClock::Ticks lockedTime = 0;
+    bool contended = false;
+    bool shared = false;
+    // False when the lock site is disabled or sampled out
+    bool traced = false;
+  };
+
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  // Cost of the trace macros, measured when the program starts
+  struct TraceDebugOverhead {
+    // Between the start and the end of an empty START_TRACE_PERFORMANCE, as measured by itself
+    TraceDebugClock::Ticks scopeInside = 0;
+    // Whole cost of an empty START_TRACE_PERFORMANCE, as seen by the measures it is nested in
+    TraceDebugClock::Ticks scope = 0;
+    TraceDebugClock::Ticks checkpoint = 0;      // ADD_TRACE_PERFORMANCE
+    TraceDebugClock::Ticks value = 0;           // DISPLAY_DEBUG_VALUE
+    TraceDebugClock::Ticks immediateValue = 0;  // DISPLAY_IMMEDIATE_DEBUG_VALUE
+    TraceDebugClock::Ticks message = 0;         // DISPLAY_DEBUG_MESSAGE
+  };
+#endif
+
+  // A trace as recorded by the traced thread: it is formatted (text or binary) only when it is written
+  struct TraceDebugEvent {
+    TraceDebugEventKind kind = TraceDebugEventKind::Text;
+    // Hierarchy deepness when the trace was done
+    unsigned int deepness = 0;
+    std::thread::id threadId;
+    TraceDebugClock::Ticks time = 0;
+    // Null for free text
+    const TraceDebugCallSite* callSite = nullptr;
+    // Value, message or free text
+    std::string text;
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+    // Values not formatted yet, displayed before text
+    TraceDebugArguments arguments;
+#endif
+    // Trace points of START_TRACE_PERFORMANCE
+    TraceDebugTimings timings;
+    // Task sites: the context and the thread which submitted the task
+    unsigned long long contextId = 0;
+    std::thread::id contextThreadId;
+  };
+
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  // Last traces of a thread, the oldest ones being overwritten
+  struct TraceDebugFlightRecorder {
+    std::vector<TraceDebugEvent> events;
+    // Index of the oldest trace once events is full
+    size_t next = 0;
+  };
+#endif
+
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+  // Traces in progress in a thread, read by the signal handler: written without lock nor allocation
+  struct TraceDebugThreadScopes {
+    static const unsigned int maxDepth = 64;
+    struct Scope {
+      const TraceDebugCallSite* callSite;
+      TraceDebugClock::Ticks startTime;
+    };
+    Scope scopes[maxDepth];
+    // May exceed maxDepth: the deepest scopes are only counted
+    std::atomic<unsigned int> depth;
+    std::thread::id threadId;
+    // Formatted beforehand: the signal handler cannot use streams
+    char threadIdText[32];
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+    const TraceDebugFlightRecorder* flightRecorder = nullptr;
+#endif
+    // Registers the scopes of the current thread for the signal handler until the thread exits
+    TraceDebugThreadScopes();
+    ~TraceDebugThreadScopes();
+    void Push(const TraceDebugCallSite& callSite, TraceDebugClock::Ticks startTime) {
+      const unsigned int currentDepth = depth.load(std::memory_order_relaxed);
+      if(currentDepth < maxDepth) {
+        scopes[currentDepth].callSite = &callSite;
+        scopes[currentDepth].startTime = startTime;
+      }
+      depth.store(currentDepth + 1, std::memory_order_release);
+    }
+    void Pop() {
+      depth.store(depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+  };
+
+  // Formats into a fixed buffer written with write(2): usable by a signal handler
+  class TraceDebugSignalWriter;
+#endif
+
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+  // Distribution of the durations of a measured segment, in ns. Buckets are logarithmic: each power of 2 is
+  // split in 4 buckets, percentiles are thus known within 12.5%.
+  class TraceDebugHistogram {
+      static const unsigned int subBucketBits = 2;
+      static const unsigned int bucketCount = (64 - subBucketBits + 1) << subBucketBits;
+      unsigned long long buckets[bucketCount];
+      unsigned long long count = 0;
+      unsigned long long sum = 0;
+      unsigned long long min = 0;
+      unsigned long long max = 0;
+      static unsigned int GetBucket(unsigned long long value);
+      static unsigned long long GetBucketMiddle(unsigned int bucket);
+
+    public:
+      TraceDebugHistogram() { std::fill(buckets, buckets + bucketCount, 0ULL); }
+      void Add(unsigned long long value);
+      void Merge(const TraceDebugHistogram& other);
+      unsigned long long GetCount() const { return count; }
+      unsigned long long GetMin() const { return min; }
+      unsigned long long GetMax() const { return max; }
+      double GetMean() const { return count > 0 ? static_cast<double>(sum) / count : 0.; }
+      // percentile is between 0 and 1
+      unsigned long long GetPercentile(double percentile) const;
+  };
+
+  // Segment between two trace points of a START_TRACE_PERFORMANCE, or its full time if fromLabel is empty
+  struct TraceDebugSegmentStatistics {
+    std::string fromLabel;
+    std::string toLabel;
+    TraceDebugHistogram histogram;
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+    // Durations without the cost of the traces
+    TraceDebugHistogram correctedHistogram;
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+    // Sum of the differences of each counter
+    unsigned long long counterSums[TraceDebugCounters::count] = {};
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+    // Sum of the allocations of each measure
+    TraceDebugAllocations allocationSums = {};
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+    // Durations measured since the last interval written
+    TraceDebugHistogram windowHistogram;
+#endif
+  };
+
+  // Statistics updated by one thread. Index is the id of a START_TRACE_PERFORMANCE call site
+  struct TraceDebugStatisticsShard {
+    std::mutex mutex;
+    std::vector<std::vector<TraceDebugSegmentStatistics>> callSites;
+  };
+#endif
+
+#ifdef TRACE_DEBUG_CALL_TREE
+  // A path of nested START_TRACE_PERFORMANCE call sites, merged across calls
+  struct TraceDebugCallTreeNode {
+    unsigned int callSiteId = 0;
+    unsigned int parent = 0;
+    std::vector<unsigned int> children;
+    unsigned long long calls = 0;
+    // Time of the measures, including the one of the nested measures
+    TraceDebugClock::Ticks totalTime = 0;
+    // Time of the nested measures
+    TraceDebugClock::Ticks childrenTime = 0;
+  };
+
+  // Call tree of one thread, or of several threads once merged. Node 0 is the root and has no call site
+  struct TraceDebugCallTree {
+    std::mutex mutex;
+    std::vector<TraceDebugCallTreeNode> nodes;
+    // Nodes of the measures in progress, innermost last
+    std::vector<unsigned int> stack;
+    // The first nodes of the stack are the ones of the thread which submitted the running task: they ran in parallel,
+    // the measures of the task are not part of their time
+    unsigned int contextDepth = 0;
+
+    TraceDebugCallTree(): nodes(1) {}
+    // Creates the child when it does not exist yet
+    unsigned int GetChild(unsigned int parent, unsigned int callSiteId);
+    // Adds the nodes of other below otherNode to the ones below node
+    void Merge(const TraceDebugCallTree& other, unsigned int otherNode = 0, unsigned int node = 0);
+  };
+#endif
+
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+  struct TraceDebugMappedHeader;
+
+  // File mapped in memory and written as a circular buffer (see TraceDebugMappedFormat.hpp)
+  class TraceDebugMappedFile {
+      TraceDebugMappedHeader* header = nullptr;
+      char* data = nullptr;
+
+    public:
+      bool Open(const std::string& fileName, unsigned long long dataSize);
+      bool IsOpen() const { return header != nullptr; }
+      // Once the buffer is full the oldest bytes are overwritten
+      void Write(const char* bytes, size_t size);
+      void Close();
+  };
+#endif
+
+  // Sampling of a call site by one thread
+  struct TraceDebugSamplingState {
+    unsigned long long calls = 0;
+    // Not added to TraceDebugCallSite::skippedCalls yet
+    unsigned long long skippedCalls = 0;
+  };
+
+  // Sampling states of a thread, Index is the call site id. Skipped calls are not lost when the thread exits
+  struct TraceDebugSamplingStates {
+    std::vector<TraceDebugSamplingState> callSites;
+    unsigned long long random = 0;
+#ifdef ENABLE_THREAD_SAFE
+    ~TraceDebugSamplingStates();
+#endif
+  };
+
+#ifdef TRACE_DEBUG_LOCK_FREE
+  // Single producer / single consumer queue: the owning thread pushes, the writer thread drains.
+  template <typename T, size_t Size>
+  class TraceDebugRingBuffer {
+      static_assert((Size & (Size - 1)) == 0, "TraceDebugRingBuffer size must be a power of 2");
+      std::unique_ptr<T[]> slots;
+      // Written by the producer only
+      std::atomic<size_t> head;
+      char padHead[64 - sizeof(std::atomic<size_t>)];
+      // Written by the consumer only
+      std::atomic<size_t> tail;
+      char padTail[64 - sizeof(std::atomic<size_t>)];
+
+    public:
+      TraceDebugRingBuffer(): slots(new T[Size]), head(0), tail(0) {}
+
+      // Returns false without blocking when the buffer is full
+      bool Push(T&& value) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if(currentHead - tail.load(std::memory_order_acquire) >= Size) {
+          return false;
+        }
+        slots[currentHead & (Size - 1)] = std::move(value);
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+      }
+
+      template <typename Consumer>
+      void Drain(Consumer&& consumer) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        const size_t currentHead = head.load(std::memory_order_acquire);
+        for(; currentTail != currentHead; ++currentTail) {
+          consumer(std::move(slots[currentTail & (Size - 1)]));
+        }
+        tail.store(currentTail, std::memory_order_release);
+      }
+
+      // Visits the values not drained yet without removing them: only used by the signal handler
+      template <typename Visitor>
+      void Peek(Visitor&& visitor) const {
+        const size_t currentHead = head.load(std::memory_order_acquire);
+        for(size_t currentTail = tail.load(std::memory_order_acquire); currentTail != currentHead; ++currentTail) {
+          visitor(slots[currentTail & (Size - 1)]);
+        }
+      }
+  };
+
+  struct TraceDebugThreadBuffer {
+    TraceDebugRingBuffer<TraceDebugEvent, TRACE_DEBUG_RING_BUFFER_SIZE> traces;
+    // Traces that could not be pushed because the writer thread is late
+    std::atomic<unsigned long long> droppedTraces;
+    TraceDebugThreadBuffer(): droppedTraces(0) {}
+  };
+#endif
+
+  // Value of a TRACE_COUNTER or TRACE_GAUGE. Each thread adds to its own shard (threads are spread over the shards, each on its
+  // own cache line): the shards are only summed when the value is read
+  struct TraceDebugCounter {
+    struct Shard {
+      std::atomic<long long> value;
+      char pad[64 - sizeof(std::atomic<long long>)];
+    };
+    Shard shards[TRACE_DEBUG_COUNTER_SHARDS];
+    std::string name;
+    // A gauge displays a level rather than a total
+    bool gauge;
+    // Shard of the current thread plus 1, 0 until its first update
+#ifdef ENABLE_THREAD_SAFE
+    static thread_local unsigned int threadShard;
+#else
+    static unsigned int threadShard;
+#endif
+    static std::atomic<unsigned int> nextShard;
+
+    TraceDebugCounter(const std::string& name, bool gauge);
+    void Add(long long delta) {
+      unsigned int shard = threadShard;
+      if(shard == 0) {
+        shard = threadShard = nextShard.fetch_add(1, std::memory_order_relaxed) % TRACE_DEBUG_COUNTER_SHARDS + 1;
+      }
+      shards[shard - 1].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+    // Sum of the shards: updates done meanwhile may be missing
+    long long Read() const;
+  };
 
   class TraceDebug {
-      // How many objects TraceDebug in nested scopes were created
+      // How many objects TraceDebug in nested scopes were created by this thread
 #ifdef ENABLE_THREAD_SAFE
-      static std::map<std::thread::id, unsigned int> debugPrintDeepness;
+      static thread_local unsigned int debugPrintDeepness;
 #else
       static unsigned int debugPrintDeepness;
+#endif
+#ifdef TRACE_DEBUG_USE_GLOBAL_MUTEX
+      // Sum of debugPrintDeepness of all threads: the hierarchy bookkeeping is shared by all threads
+      static std::atomic<unsigned int> allDebugPrintDeepness;
 #endif
       // How many elements to be cached
-      static unsigned int traceCacheDeepness;
+      static std::atomic<unsigned int> traceCacheDeepness;
       // Traces are active / Inactive
-      static bool traceActive;
+      static std::atomic<bool> traceActive;
       // Display a message when starting a trace performance if true
       // Will display only final result if false
-      static bool displayStartTracePerformance;
+      static std::atomic<bool> displayStartTracePerformance;
       // Local cache to be used instead of the output
-      static std::vector<std::string> localCache;
-      // Key is filename + functioname, Value is line number
-      static std::map<std::string, int> mapFileNameToLine;
-      // Key is filename + functioname + unique key,
-      // Value is a vector of pair containing a variable name as first and timing as second
-      static std::map<std::string, std::vector<std::pair<std::string,
-                                               std::chrono::steady_clock::time_point>>> mapFileNameFunctionNameToVectorTimingInfo;      
+      static std::vector<TraceDebugEvent> localCache;
+      // Index is the scope id of a call site (filename + functioname), Value is the line number of the trace being done or 0
+      static TRACE_DEBUG_PER_THREAD std::vector<int> scopeLines;
+      // Trace points of the START_TRACE_PERFORMANCE in progress in this thread, index is measureIndex: each invocation,
+      // recursive ones included, has its own. Vectors are kept once the measure is done so that their capacity is reused
+#ifdef ENABLE_THREAD_SAFE
+      static thread_local std::vector<TraceDebugTimings> measureTimings;
+      static thread_local unsigned int measureCount;
+#else
+      static std::vector<TraceDebugTimings> measureTimings;
+      static unsigned int measureCount;
+#endif
+      // Key is filename + functioname, Value is the scope id
+      static std::map<std::string, unsigned int> scopeIds;
+#ifdef ENABLE_THREAD_SAFE
+      static thread_local TraceDebugSamplingStates samplingStates;
+#else
+      static TraceDebugSamplingStates samplingStates;
+#endif
+      // Call site name and sampling set by SetSampling, in the order they were set
+      static std::vector<std::pair<std::string, const TraceDebugSampling*>> samplingRules;
+      // Call sites may use a policy while a new one is set: they are never deleted
+      static std::deque<TraceDebugSampling> samplingPolicies;
+      // Call site name and state set by SetEnabled and TRACE_DEBUG_ENABLE, in the order they were set
+      static std::vector<std::pair<std::string, bool>> enableRules;
+      static bool enableRulesLoaded;
+      // Index is the call site id
+      static std::vector<const TraceDebugCallSite*> callSites;
+      // Counters of TRACE_COUNTER and TRACE_GAUGE, in the order they were first used. Never removed: the macros keep a reference
+      static std::deque<TraceDebugCounter> counters;
+#ifdef ENABLE_THREAD_SAFE
+      static std::mutex countersMutex;
+#endif
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+      // Statistics of the current thread, created on its first measure
+      static thread_local std::shared_ptr<TraceDebugStatisticsShard> statisticsShard;
+      // Statistics of all threads: a shard only referenced here belongs to a thread that exited
+      static std::vector<std::shared_ptr<TraceDebugStatisticsShard>> statisticsShards;
+      // Statistics of the threads that exited
+      static TraceDebugStatisticsShard exitedThreadsStatistics;
+      static std::mutex statisticsShardsMutex;
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+      static std::ofstream timeSeriesFile;
+      static bool timeSeriesJson;
+      static unsigned int timeSeriesIntervalMs;
+      // Start of the interval being measured
+      static TraceDebugClock::Ticks timeSeriesWindowStart;
+      static std::thread timeSeriesThread;
+      static std::mutex timeSeriesMutex;
+      static std::condition_variable timeSeriesCondition;
+      static bool timeSeriesStopRequested;
+#endif
+#ifdef TRACE_DEBUG_CALL_TREE
+      // Call tree of the current thread, created on its first measure
+      static thread_local std::shared_ptr<TraceDebugCallTree> callTree;
+      // Call trees of all threads: a tree only referenced here belongs to a thread that exited
+      static std::vector<std::shared_ptr<TraceDebugCallTree>> callTrees;
+      // Call tree of the threads that exited
+      static TraceDebugCallTree exitedThreadsCallTree;
+      static std::mutex callTreesMutex;
+#endif
+      // Ids given to the captured contexts
+      static std::atomic<unsigned long long> contextCount;
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+      // Last traces of this thread
+#ifdef ENABLE_THREAD_SAFE
+      static thread_local TraceDebugFlightRecorder flightRecorder;
+#else
+      static TraceDebugFlightRecorder flightRecorder;
+#endif
+      // Call site name and threshold set by SetSlowThreshold, in the order they were set
+      static std::vector<std::pair<std::string, TraceDebugClock::Ticks>> slowThresholdRules;
+#endif
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+      // Scopes in progress in this thread
+#ifdef ENABLE_THREAD_SAFE
+      static thread_local TraceDebugThreadScopes threadScopes;
+#else
+      static TraceDebugThreadScopes threadScopes;
+#endif
+      // Scopes of all threads, null when the slot is free
+      static std::atomic<TraceDebugThreadScopes*> allThreadScopes[TRACE_DEBUG_SIGNAL_MAX_THREADS];
+      static int signalFileDescriptor;
+      static std::atomic<bool> signalReceived;
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+      static TraceDebugOverhead overhead;
+      // Cost of the traces done by this thread since it started
+#ifdef ENABLE_THREAD_SAFE
+      static thread_local TraceDebugClock::Ticks threadOverhead;
+#else
+      static TraceDebugClock::Ticks threadOverhead;
+#endif
+      // Set while the overhead is measured: traces are not output, Value is the last duration measured
+#ifdef ENABLE_THREAD_SAFE
+      static thread_local TraceDebugClock::Ticks* overheadMeasure;
+#else
+      static TraceDebugClock::Ticks* overheadMeasure;
+#endif
+#endif
       // Mutex
 #ifdef ENABLE_THREAD_SAFE
       static std::recursive_mutex the_mutex;
+      static std::mutex callSitesMutex;
 #endif
+#ifdef TRACE_DEBUG_LOCK_FREE
+      // Buffer of the current thread, created on its first trace
+      static thread_local std::shared_ptr<TraceDebugThreadBuffer> threadBuffer;
+      // Buffers of all threads: a buffer only referenced here belongs to a thread that exited
+      static std::vector<std::shared_ptr<TraceDebugThreadBuffer>> threadBuffers;
+      static std::mutex threadBuffersMutex;
+#endif
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+      // Outputs not yet written
+      static std::vector<TraceDebugEvent> pendingOutputs;
+      static std::thread writerThread;
+      static std::mutex writerMutex;
+      static std::condition_variable writerCondition;
+      static bool writerStopRequested;
+      static std::atomic<unsigned int> outputFlushIntervalMs;
+#endif
+      static std::atomic<unsigned long long> droppedTraces;
 
       bool debugPrintMustBeDecremented = false;
       bool debugPerformanceMustBeDisplayed = false;
-      std::string keyDebugPrintToErase;
-      // For performance analyse, contains filename + functioname + unique key,
-      std::string keyDebugPerformanceToErase;
-      std::string lineHeader;
-      std::string GetUniqueKey(const std::string & string1,
-                               const std::string & string2,
-                               const std::string & string3 = "");      
+      bool traced = true;
+      // Index of the trace points of this measure in measureTimings
+      unsigned int measureIndex = 0;
+      const TraceDebugCallSite& callSite;
 
     public:
-      TraceDebug(const std::string & functionName, const std::string & fileName, int lineNumber, const std::string &uniqueKey);
-      TraceDebug(const std::string & functionName, const std::string & fileName, int lineNumber = __LINE__);
-      ~TraceDebug();
-      void  AddTrace(std::chrono::steady_clock::time_point timePoint, const std::string & variableName);
+      // A disabled call site only costs a relaxed load and a branch: everything else is out of line
+      TraceDebug(const TraceDebugCallSite& callSite, bool measurePerformance = false): callSite(callSite) {
+        if(callSite.enabled.load(std::memory_order_relaxed)) {
+          StartTrace(measurePerformance);
+        } else {
+          traced = false;
+        }
+      }
+      ~TraceDebug() {
+        if(traced) {
+          EndTrace();
+        }
+      }
+      void  AddTrace(TraceDebugClock::Ticks timePoint, const char* variableName);
+      // Labels built at run time are interned: the trace point keeps a pointer to them
+      void  AddTrace(TraceDebugClock::Ticks timePoint, const std::string & variableName);
+      // False when the call site is disabled or sampling skipped this trace: nothing is done
+      bool  IsTraced() const { return traced; }
 
       static void ActiveTrace(bool activate);
-      static bool IsTraceActive();
+      static bool IsTraceActive() { return traceActive.load(std::memory_order_relaxed); }
       static void PrintString(const std::string & inStr, bool showHierarchy);
+      static void PrintEvent(TraceDebugEventKind kind, const TraceDebugCallSite& callSite, std::string && text);
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+      static void PrintEvent(TraceDebugEventKind kind, const TraceDebugCallSite& callSite, TraceDebugDeferredValue && value);
+#endif
+      // Gives its ids to a call site, called once per call site
+      static void RegisterCallSite(TraceDebugCallSite& callSite, const char* scopeFileName);
       static void SetTracePerformanceCacheDeepness(unsigned int cacheDeepness);
       static void Finalize();
+      // Makes Finalize run when the program ends, once whatever the number of callers
+      static void FinalizeAtExit();
       static std::string GetDiffTimeSinceStartAndThreadId();
       static void DisplayStartTracePerformance(bool inDisplayStartTracePerformance);
+      static void SetOutputFlushInterval(unsigned int flushIntervalMs);
+      // Number of traces lost because a thread buffer was full (always 0 without TRACE_DEBUG_LOCK_FREE)
+      static unsigned long long GetDroppedTraceCount();
+      static void PrintStatistics();
+      // Counter (or gauge) named name, created on first use
+      static TraceDebugCounter& GetCounter(const std::string& name, bool gauge);
+#ifdef TRACE_DEBUG_CALL_TREE
+      static void PrintCallTree(unsigned int topCount);
+      static void WriteFoldedStacks(const std::string& fileName);
+#endif
+      static void SetSampling(const std::string& callSiteName, const TraceDebugSampling& sampling);
+      static void SetEnabled(const std::string& callSiteName, bool enabled);
+#ifdef TRACE_DEBUG_TIME_SERIES
+      static void StartTimeSeries(const std::string& fileName, unsigned int intervalMs);
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+      static void SetSlowThreshold(const std::string& callSiteName, std::chrono::nanoseconds threshold);
+#endif
+      // Called by the traced locks and task submissions: same rules as the constructor of a trace
+      static bool IsSiteTraced(const TraceDebugCallSite& site) {
+        if(!site.enabled.load(std::memory_order_relaxed)) {
+          return false;
+        }
+        const TraceDebugSampling* sampling = site.sampling.load(std::memory_order_acquire);
+        return sampling == nullptr || Sample(*sampling, site);
+      }
+      // Records a lock acquisition as a measure of its lock site: "Lock", "Locked" (or "Locked shared") and "Unlocked"
+      static void AddLockMeasure(const TraceDebugCallSite& lockSite, const TraceDebugLockTimes& times,
+                                 TraceDebugClock::Ticks unlockedTime);
+      // Captures the hierarchy of the current thread for a task submitted at taskSite
+      static TraceDebugContext CaptureContext(const TraceDebugCallSite& taskSite);
+      // Called by the thread running the task: its traces are nested in the ones of the submitting thread, and the time
+      // the task waited is recorded as a measure of the task site: "Submitted" and "Started"
+      static TraceDebugContextState EnterContext(const TraceDebugContext& context);
+      static void LeaveContext(const TraceDebugContextState& state);
+      // Adds the skipped calls counted by the current thread to the call sites
+      static void FlushSkippedCalls(TraceDebugSamplingStates& states);
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+      static void InstallSignalHandler(int fileDescriptor);
+      static void RegisterThreadScopes(TraceDebugThreadScopes& scopes);
+      static void UnregisterThreadScopes(TraceDebugThreadScopes& scopes);
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+      // Measures the cost of each trace macro, done by the first trace of the program
+      static void MeasureOverhead();
+      static const TraceDebugOverhead& GetOverhead();
+#endif
 #ifdef USE_QT_DEBUG
       template <typename T>
       static std::string QtToString(const T& dataToWrite) {
@@ -238,21 +1446,141 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #endif
 
   private:
-      std::string GetPerformanceResults();
+      static bool Sample(const TraceDebugSampling& sampling, const TraceDebugCallSite& callSite);
+      // callSiteName may contain the wildcards * and ?
+      static bool IsCallSiteMatching(const std::string& callSiteName, const TraceDebugCallSite& callSite);
+      static bool IsGlobMatching(const char* pattern, const char* text);
+      // Adds the rules of the environment variable TRACE_DEBUG_ENABLE once, before any other
+      static void LoadEnableRules();
+      void StartTrace(bool measurePerformance);
+      void EndTrace();
+      // Displays the calls skipped by sampling of the call sites for which statisticsDisplayed is not true
+      static void OutputSkippedCalls(const std::vector<bool>& statisticsDisplayed);
+      // Value of each counter and gauge
+      static std::vector<std::pair<const TraceDebugCounter*, long long>> ReadCounters();
+      // Displays the value of each counter and gauge
+      static void OutputCounters();
+      void AddTimePoint(TraceDebugClock::Ticks timePoint, const char* variableName);
+      // Returns a copy of label which lives until the program ends
+      static const char* InternLabel(const std::string& label);
+      // Once the measure is done its trace points are moved to the event rather than copied
+      TraceDebugEvent CreatePerformanceEvent(bool measureDone);
       void DisplayPerformanceMeasure();
-      void CacheOrPrintTimings(std::string &&output);
-      void IncreaseDebugPrintDeepness();
-      void DecreaseDebugPrintDeepness();
+      void CacheOrPrintTimings(TraceDebugEvent &&output);
+      static void IncreaseDebugPrintDeepness();
+      static void DecreaseDebugPrintDeepness();
 
-      static std::string getSpaces();
-      static void CacheOrPrintOutputs(std::string &&output);
+      static std::string getSpaces(unsigned int deepness);
+      static TraceDebugEvent CreateEvent(TraceDebugEventKind kind, bool showHierarchy,
+                                         TraceDebugClock::Ticks time = TraceDebugClock::Now());
+      static void DispatchEvent(TraceDebugEvent &&output);
+      static void CacheOrPrintOutputs(TraceDebugEvent &&output);
+      static void OutputEvent(TraceDebugEvent &&output);
+      // Formatting is done where the trace is written
+      static std::string FormatEvent(const TraceDebugEvent& event);
+      static std::string GetEventText(const TraceDebugEvent& event);
+      static std::string FormatTimeAndThreadId(TraceDebugClock::Ticks time, std::thread::id threadId);
+      static std::string FormatDuration(TraceDebugClock::Ticks ticks);
+      static std::string FormatDuration(const TraceDebugTiming& from, const TraceDebugTiming& to);
+      static std::string FormatLabel(const TraceDebugTiming& timing);
+      static const std::string& FormatThreadId(std::thread::id threadId);
+      static std::string GetPerformanceResults(const TraceDebugCallSite& callSite, const TraceDebugTimings& performanceInfos);
+      static void AppendEvent(const TraceDebugEvent& event, std::string& output);
+      static void WriteBatch(const std::string& batch, bool flush);
+      // Thread ids already formatted
+      static std::map<std::thread::id, std::string> threadIdTexts;
 #ifdef WRITE_OUTPUT_TO_FILE
       static std::ofstream outputFile;
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+      static TraceDebugMappedFile mappedFile;
+#endif
       static void WriteToFile(const std::string& stringToWrite, const std::string& fileName);
+      static void OpenOutputFile(const std::string& fileName);
+#endif
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+      // Segment being written, its name is outputSegmentBaseName.<outputSegmentNumber>.log
+      static std::string outputSegmentBaseName;
+      static unsigned long long outputSegmentNumber;
+      static unsigned long long outputSegmentSize;
+      static std::chrono::steady_clock::time_point outputSegmentOpenTime;
+      // Closed segments not yet compressed, and segments kept (oldest first) only used by the archive thread
+      static std::vector<std::string> pendingSegments;
+      static std::deque<std::string> archivedSegments;
+      static std::thread archiveThread;
+      static std::mutex archiveMutex;
+      static std::condition_variable archiveCondition;
+      static bool archiveStopRequested;
+      static void RotateOutputFile();
+      static void CloseOutputSegment();
+      static void StopArchiveThread();
+      static void ArchiveSegments();
+#ifdef TRACE_DEBUG_COMPRESS_OUTPUT
+      static std::string CompressSegment(const std::string& fileName);
+#endif
+#endif
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+      // Ids of the call sites, threads and labels already defined in the binary file
+      static std::vector<bool> binaryCallSitesWritten;
+      static std::map<std::thread::id, unsigned int> binaryThreadIndexes;
+      static std::map<std::string, unsigned int> binaryLabelIds;
+      static void AppendBinaryEvent(const TraceDebugEvent& event, std::string& output);
+#endif
+#ifdef TRACE_DEBUG_CHROME_TRACE
+      // Threads already named in the trace file, Value is the tid written
+      static std::map<std::thread::id, unsigned int> chromeTraceThreadIds;
+      static unsigned long long chromeTraceEventCount;
+      static void AppendChromeTraceEvent(const TraceDebugEvent& event, std::string& output);
+      // A point of the counter track of each counter and gauge
+      static void AppendChromeCounters(std::string& output);
+#endif
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+      static void AddStatistics(const TraceDebugCallSite& callSite, const TraceDebugTimings& timings);
+      static void MergeStatistics(const TraceDebugStatisticsShard& shard, TraceDebugStatisticsShard& result);
+      static void OutputStatistics();
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+      // Moves the durations measured since the last interval into result
+      static void TakeWindowStatistics(TraceDebugStatisticsShard& result);
+      static void StopTimeSeriesThread();
+      static void WriteTimeSeries();
+      // Writes the statistics of the interval ending now
+      static void WriteTimeSeriesWindow();
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+      static void RecordEvent(TraceDebugEvent&& event);
+      // True when the measure lasted more than the threshold of its call site and its traces can be output
+      static bool IsSlowCall(const TraceDebugCallSite& site, const TraceDebugTimings& timings);
+      // Outputs the traces recorded by the thread, the last one being the slow measure
+      static void DumpFlightRecorder(const TraceDebugCallSite& site, const TraceDebugTimings& timings);
+#endif
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+      static void HandleFatalSignal(int signalNumber);
+      // Writes an event as FormatEvent does, without allocating
+      static void WriteSignalEvent(TraceDebugSignalWriter& writer, const TraceDebugEvent& event);
+      static const char* GetThreadIdText(std::thread::id threadId);
+#endif
+#ifdef TRACE_DEBUG_CALL_TREE
+      // Created on the first measure of the thread
+      static TraceDebugCallTree& GetThreadCallTree();
+      void EnterCallTree();
+      void LeaveCallTree(const TraceDebugTimings& timings);
+      // Merges the call trees of all threads into result
+      static void MergeCallTrees(TraceDebugCallTree& result);
+      static void OutputCallTree(unsigned int topCount);
 #endif
       static void PrintCache();
       static unsigned int GetDebugPrintDeepness();
       static unsigned int GetAllDebugPrintDeepness();
+#ifdef TRACE_DEBUG_LOCK_FREE
+      static void PushToThreadBuffer(TraceDebugEvent &&output);
+      static void DrainThreadBuffers();
+#endif
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+      static void WriteAsync(TraceDebugEvent &&output);
+      static void StartWriterThread();
+      static void StopWriterThread();
+      static void WriteOutputs();
+#endif
 
   };
 
@@ -263,6 +1591,232 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
     }
   };
 
+// =============================================================================================
+
+  // Locks a mutex measuring the wait: an uncontended lock is taken by try_lock, so that only one more clock read is done on unlock
+  template <typename Mutex>
+  struct TraceDebugLocker {
+    static void Lock(Mutex& mutex, const TraceDebugCallSite& lockSite, TraceDebugLockTimes& times) {
+      times.traced = TraceDebug::IsSiteTraced(lockSite);
+      if(!times.traced) {
+        mutex.lock();
+        return;
+      }
+      times.lockTime = TraceDebugClock::Now();
+      times.contended = !mutex.try_lock();
+      if(times.contended) {
+        mutex.lock();
+        times.lockedTime = TraceDebugClock::Now();
+      } else {
+        times.lockedTime = times.lockTime;
+      }
+    }
+    static void LockShared(Mutex& mutex, const TraceDebugCallSite& lockSite, TraceDebugLockTimes& times) {
+      times.shared = true;
+      times.traced = TraceDebug::IsSiteTraced(lockSite);
+      if(!times.traced) {
+        mutex.lock_shared();
+        return;
+      }
+      times.lockTime = TraceDebugClock::Now();
+      times.contended = !mutex.try_lock_shared();
+      if(times.contended) {
+        mutex.lock_shared();
+        times.lockedTime = TraceDebugClock::Now();
+      } else {
+        times.lockedTime = times.lockTime;
+      }
+    }
+    // The measure is recorded once the mutex is released
+    static void Unlock(Mutex& mutex, const TraceDebugCallSite& lockSite, const TraceDebugLockTimes& times) {
+      if(!times.traced) {
+        mutex.unlock();
+        return;
+      }
+      const TraceDebugClock::Ticks unlockedTime = TraceDebugClock::Now();
+      mutex.unlock();
+      TraceDebug::AddLockMeasure(lockSite, times, unlockedTime);
+    }
+    static void UnlockShared(Mutex& mutex, const TraceDebugCallSite& lockSite, const TraceDebugLockTimes& times) {
+      if(!times.traced) {
+        mutex.unlock_shared();
+        return;
+      }
+      const TraceDebugClock::Ticks unlockedTime = TraceDebugClock::Now();
+      mutex.unlock_shared();
+      TraceDebug::AddLockMeasure(lockSite, times, unlockedTime);
+    }
+  };
+
+  // Locks a mutex (or its shared side) until the end of the scope. Created by TRACE_LOCK_GUARD and TRACE_SHARED_LOCK_GUARD
+  template <typename MutexReference, bool shared = false>
+  class TraceDebugLockGuard {
+      typedef typename std::remove_reference<MutexReference>::type Mutex;
+      Mutex& mutex;
+      const TraceDebugCallSite& lockSite;
+      TraceDebugLockTimes times;
+
+      void Lock(std::false_type) { TraceDebugLocker<Mutex>::Lock(mutex, lockSite, times); }
+      void Lock(std::true_type) { TraceDebugLocker<Mutex>::LockShared(mutex, lockSite, times); }
+      void Unlock(std::false_type) { TraceDebugLocker<Mutex>::Unlock(mutex, lockSite, times); }
+      void Unlock(std::true_type) { TraceDebugLocker<Mutex>::UnlockShared(mutex, lockSite, times); }
+
+    public:
+      TraceDebugLockGuard(Mutex& mutex, const TraceDebugCallSite& lockSite): mutex(mutex), lockSite(lockSite) {
+        Lock(std::integral_constant<bool, shared>());
+      }
+      ~TraceDebugLockGuard() {
+        Unlock(std::integral_constant<bool, shared>());
+      }
+      TraceDebugLockGuard(const TraceDebugLockGuard&) = delete;
+      TraceDebugLockGuard& operator=(const TraceDebugLockGuard&) = delete;
+  };
+
+  // Mutex measuring the wait and hold times of all its acquisitions, whatever locks it: std::lock_guard, std::unique_lock,
+  // std::condition_variable_any... See TRACED_MUTEX
+  template <typename Mutex>
+  class TraceDebugMutex {
+    protected:
+      Mutex mutex;
+      // Called on each lock: the call site is only created once traces can be registered, even for a global mutex
+      const TraceDebugCallSite& (*getLockSite)();
+      // Only accessed by the owner
+      TraceDebugLockTimes times;
+      // Acquisitions not released yet by the owner, more than 1 for a recursive mutex: only the outermost one is measured
+      unsigned int depth = 0;
+
+    public:
+      explicit TraceDebugMutex(const TraceDebugCallSite& (*getLockSite)()): getLockSite(getLockSite) {}
+      TraceDebugMutex(const TraceDebugMutex&) = delete;
+      TraceDebugMutex& operator=(const TraceDebugMutex&) = delete;
+
+      void lock() {
+        TraceDebugLockTimes lockTimes;
+        TraceDebugLocker<Mutex>::Lock(mutex, getLockSite(), lockTimes);
+        if(depth++ == 0) {
+          times = lockTimes;
+        }
+      }
+      bool try_lock() {
+        if(!mutex.try_lock()) {
+          return false;
+        }
+        if(depth++ > 0) {
+          return true;
+        }
+        times = TraceDebugLockTimes();
+        times.traced = TraceDebug::IsSiteTraced(getLockSite());
+        if(times.traced) {
+          times.lockTime = times.lockedTime = TraceDebugClock::Now();
+        }
+        return true;
+      }
+      void unlock() {
+        if(--depth > 0) {
+          mutex.unlock();
+          return;
+        }
+        // Another thread may write the times as soon as the mutex is released
+        const TraceDebugLockTimes lockTimes = times;
+        TraceDebugLocker<Mutex>::Unlock(mutex, getLockSite(), lockTimes);
+      }
+  };
+
+  // Shared mutex (std::shared_timed_mutex, std::shared_mutex...) measuring its exclusive and shared acquisitions
+  template <typename SharedMutex>
+  class TraceDebugSharedMutex: public TraceDebugMutex<SharedMutex> {
+      // Shared owners are several: each thread keeps the times of the shared locks it holds
+      static std::vector<std::pair<const void*, TraceDebugLockTimes>>& GetSharedTimes() {
+        static thread_local std::vector<std::pair<const void*, TraceDebugLockTimes>> sharedTimes;
+        return sharedTimes;
+      }
+
+    public:
+      explicit TraceDebugSharedMutex(const TraceDebugCallSite& (*getLockSite)()): TraceDebugMutex<SharedMutex>(getLockSite) {}
+
+      void lock_shared() {
+        TraceDebugLockTimes lockTimes;
+        TraceDebugLocker<SharedMutex>::LockShared(this->mutex, this->getLockSite(), lockTimes);
+        GetSharedTimes().emplace_back(this, lockTimes);
+      }
+      bool try_lock_shared() {
+        if(!this->mutex.try_lock_shared()) {
+          return false;
+        }
+        TraceDebugLockTimes lockTimes;
+        lockTimes.shared = true;
+        lockTimes.traced = TraceDebug::IsSiteTraced(this->getLockSite());
+        if(lockTimes.traced) {
+          lockTimes.lockTime = lockTimes.lockedTime = TraceDebugClock::Now();
+        }
+        GetSharedTimes().emplace_back(this, lockTimes);
+        return true;
+      }
+      void unlock_shared() {
+        auto& sharedTimes = GetSharedTimes();
+        // Usually the last one locked
+        for(auto it = sharedTimes.rbegin(); it != sharedTimes.rend(); ++it) {
+          if(it->first == this) {
+            const TraceDebugLockTimes lockTimes = it->second;
+            sharedTimes.erase(std::next(it).base());
+            TraceDebugLocker<SharedMutex>::UnlockShared(this->mutex, this->getLockSite(), lockTimes);
+            return;
+          }
+        }
+        // Locked by another thread: the hold time is unknown
+        this->mutex.unlock_shared();
+      }
+  };
+
+// =============================================================================================
+
+  // Nests the traces of the scope in the context of the thread which submitted the task, see TRACE_RESTORE_CONTEXT
+  class TraceDebugContextScope {
+      TraceDebugContextState state;
+
+    public:
+      explicit TraceDebugContextScope(const TraceDebugContext& context): state(TraceDebug::EnterContext(context)) {}
+      ~TraceDebugContextScope() {
+        TraceDebug::LeaveContext(state);
+      }
+      TraceDebugContextScope(const TraceDebugContextScope&) = delete;
+      TraceDebugContextScope& operator=(const TraceDebugContextScope&) = delete;
+  };
+
+  // Function run by TRACE_ASYNC in the context of the thread which called it
+  template <typename Function>
+  class TraceDebugContextTask {
+      TraceDebugContext context;
+      Function function;
+
+    public:
+      TraceDebugContextTask(TraceDebugContext&& context, Function&& function):
+        context(std::move(context)), function(std::move(function)) {}
+      template <typename... Args>
+      auto operator()(Args&&... args) -> decltype(std::declval<Function&>()(std::forward<Args>(args)...)) {
+        TraceDebugContextScope scope(context);
+        return function(std::forward<Args>(args)...);
+      }
+  };
+
+  template <typename Function, typename... Args>
+  auto TraceDebugAsync(TraceDebugContext&& context, std::launch policy, Function&& function, Args&&... args)
+      -> decltype(std::async(policy, std::declval<TraceDebugContextTask<typename std::decay<Function>::type>>(),
+                             std::forward<Args>(args)...)) {
+    typedef typename std::decay<Function>::type Task;
+    return std::async(policy, TraceDebugContextTask<Task>(std::move(context), Task(std::forward<Function>(function))),
+                      std::forward<Args>(args)...);
+  }
+
+  template <typename Function, typename... Args>
+  auto TraceDebugAsync(TraceDebugContext&& context, Function&& function, Args&&... args)
+      -> decltype(std::async(std::declval<TraceDebugContextTask<typename std::decay<Function>::type>>(),
+                             std::forward<Args>(args)...)) {
+    typedef typename std::decay<Function>::type Task;
+    return std::async(TraceDebugContextTask<Task>(std::move(context), Task(std::forward<Function>(function))),
+                      std::forward<Args>(args)...);
+  }
+
 
 #else
   #define DISPLAY_DEBUG_ACTIVE_TRACE
@@ -275,5 +1829,27 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
   #define ADD_TRACE_PERFORMANCE(unique_key, userInfo)
   #define SET_TRACE_PERFORMANCE_CACHE_DEEPNESS(cache_deepness)
   #define DISPLAY_START_TRACE_PERFORMANCE(displayStartTracePerformance)
+  #define SET_TRACE_OUTPUT_FLUSH_INTERVAL(flushIntervalMs)
+  #define PRINT_TRACE_PERFORMANCE_STATISTICS
+  #define TRACE_COUNTER(name, increment)
+  #define TRACE_GAUGE(name, delta)
+  #define SET_TRACE_SAMPLING(callSiteName, sampling)
+  #define SET_TRACE_ENABLED(callSiteName, enabled)
+  #define SET_TRACE_SLOW_THRESHOLD(callSiteName, threshold)
+  #define TRACE_INSTALL_SIGNAL_HANDLER(fileDescriptor)
+  #define START_TRACE_TIME_SERIES(fileName, intervalMs)
+  #define PRINT_TRACE_CALL_TREE(topCount)
+  #define WRITE_TRACE_FOLDED_STACKS(fileName)
+  #define TOKENPASTE(x, y) x ## y
+  #define TOKENPASTE_EXPAND(x, y) TOKENPASTE(x , y)
+  #define TRACE_LOCK_GUARD(mutex) \
+    std::lock_guard<std::remove_reference<decltype(mutex)>::type> TOKENPASTE_EXPAND(__UnusedLock, __LINE__)(mutex);
+  #define TRACE_SHARED_LOCK_GUARD(mutex) \
+    std::shared_lock<std::remove_reference<decltype(mutex)>::type> TOKENPASTE_EXPAND(__UnusedLock, __LINE__)(mutex);
+  #define TRACED_MUTEX(mutexType, name) mutexType name
+  #define TRACED_SHARED_MUTEX(sharedMutexType, name) sharedMutexType name
+  #define TRACE_ASYNC(...) std::async(__VA_ARGS__)
+  #define TRACE_CAPTURE_CONTEXT nullptr
+  #define TRACE_RESTORE_CONTEXT(context) (void)(context);
 #endif
 #endif
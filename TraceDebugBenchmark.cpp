@@ -0,0 +1,397 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2BlackCoffees 2016
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Measures the cost of each trace macro: nanoseconds and allocations per call, for 1, 2, 4 ... N threads, with the
+// traces active, deactivated by DISPLAY_DEBUG_DEACTIVE_TRACE or disabled by SET_TRACE_ENABLED, and with the cache of
+// performance measures disabled or enabled. Build it once per configuration to compare, e.g. with the global mutex
+// and with TRACE_DEBUG_LOCK_FREE:
+//
+// g++ -std=c++11 -O2 -DTRACE_DEBUG_HPP_NO_DEBUG_LOCAL -o TraceDebugBenchmark TraceDebugBenchmark.cpp TraceDebug.cpp -pthread
+// g++ -std=c++11 -O2 -DTRACE_DEBUG_HPP_NO_DEBUG_LOCAL -DTRACE_DEBUG_LOCK_FREE -o TraceDebugBenchmarkLockFree TraceDebugBenchmark.cpp TraceDebug.cpp -pthread
+//
+// ./TraceDebugBenchmark [maxThreads] [iterationsPerThread] [results.json] > /dev/null
+// The traces are written to std::cout. The results are written as JSON to results.json, or to std::cerr when no file
+// is given.
+// With TRACE_DEBUG_COUNT_ALLOCATIONS the allocations per call are the ones counted by TraceDebug.cpp, which leaves out
+// the allocations of the trace macros themselves.
+
+#include "TraceDebug.hpp"
+#include <cstdlib>
+#include <new>
+
+// With TRACE_DEBUG_COUNT_ALLOCATIONS, TraceDebug.cpp replaces the global operator new itself
+#if !defined(ENABLE_TRACE_DEBUG) || !defined(TRACE_DEBUG_COUNT_ALLOCATIONS)
+// Allocations done by the current thread, counted by the global operator new below
+static thread_local unsigned long long threadAllocations = 0;
+
+void* operator new(std::size_t size)
+{
+  ++threadAllocations;
+  void* memory = std::malloc(size > 0 ? size : 1);
+  if (memory == nullptr)
+    throw std::bad_alloc();
+  return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+  std::free(memory);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* memory, std::size_t) noexcept
+{
+  std::free(memory);
+}
+#endif
+#endif
+
+#ifdef ENABLE_TRACE_DEBUG
+static unsigned long long GetThreadAllocations()
+{
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+  // The allocations done inside the trace macros are not counted by TraceDebug.cpp
+  TraceDebugAllocations allocations;
+  TraceDebugAllocationCounter::Read(allocations);
+  return allocations.count;
+#else
+  return threadAllocations;
+#endif
+}
+
+// Each macro has its own call site. They are called through a pointer so that the compiler cannot specialize them.
+void CallNothing(unsigned int)
+{
+}
+
+void CallStartTracePerformance(unsigned int)
+{
+  START_TRACE_PERFORMANCE(benchmarkScope);
+}
+
+void CallAddTracePerformance(unsigned int)
+{
+  START_TRACE_PERFORMANCE(benchmarkCheckpoint);
+  ADD_TRACE_PERFORMANCE(benchmarkCheckpoint, "Middle");
+}
+
+void CallDisplayImmediateDebugValue(unsigned int iteration)
+{
+  DISPLAY_IMMEDIATE_DEBUG_VALUE(iteration);
+}
+
+void CallDisplayDebugValue(unsigned int iteration)
+{
+  DISPLAY_DEBUG_VALUE(iteration);
+}
+
+void CallDisplayDebugMessage(unsigned int iteration)
+{
+  DISPLAY_DEBUG_MESSAGE("Iteration " << iteration);
+}
+
+struct BenchmarkMacro
+{
+  const char* name;
+  // What one operation does
+  const char* operation;
+  // Label, function or file of its call site
+  const char* callSiteName;
+  void (*call)(unsigned int);
+};
+
+static const BenchmarkMacro benchmarkMacros[] = {
+  {"none", "empty function: cost of the benchmark loop", "CallNothing", CallNothing},
+  {"START_TRACE_PERFORMANCE", "START_TRACE_PERFORMANCE", "benchmarkScope", CallStartTracePerformance},
+  {"ADD_TRACE_PERFORMANCE", "START_TRACE_PERFORMANCE + ADD_TRACE_PERFORMANCE", "benchmarkCheckpoint", CallAddTracePerformance},
+  {"DISPLAY_IMMEDIATE_DEBUG_VALUE", "DISPLAY_IMMEDIATE_DEBUG_VALUE(unsigned int)", "CallDisplayImmediateDebugValue",
+   CallDisplayImmediateDebugValue},
+  {"DISPLAY_DEBUG_VALUE", "DISPLAY_DEBUG_VALUE(unsigned int)", "CallDisplayDebugValue", CallDisplayDebugValue},
+  {"DISPLAY_DEBUG_MESSAGE", "DISPLAY_DEBUG_MESSAGE(\"Iteration \" << unsigned int)", "CallDisplayDebugMessage",
+   CallDisplayDebugMessage},
+};
+
+enum class TraceState { Active, Deactivated, Disabled };
+
+static const char* GetTraceStateName(TraceState state)
+{
+  switch (state)
+  {
+    case TraceState::Active: return "active";
+    case TraceState::Deactivated: return "deactivated";
+    default: return "disabled";
+  }
+}
+
+struct BenchmarkResult
+{
+  const BenchmarkMacro* macro;
+  TraceState state;
+  unsigned int cacheDeepness;
+  unsigned int threadCount;
+  unsigned int iterations;
+  // Mean over the threads of the time of one call
+  double nanosecondsPerOperation;
+  // Calls done by all threads per second
+  double operationsPerSecond;
+  double allocationsPerOperation;
+  unsigned long long droppedTraces;
+};
+
+BenchmarkResult Measure(const BenchmarkMacro& macro, TraceState state, unsigned int cacheDeepness, unsigned int threadCount,
+                        unsigned int iterations)
+{
+  SET_TRACE_PERFORMANCE_CACHE_DEEPNESS(cacheDeepness);
+  SET_TRACE_ENABLED(macro.callSiteName, state != TraceState::Disabled);
+  if (state == TraceState::Deactivated)
+    DISPLAY_DEBUG_DEACTIVE_TRACE;
+  else
+    DISPLAY_DEBUG_ACTIVE_TRACE;
+  const unsigned long long droppedBefore = TraceDebug::GetDroppedTraceCount();
+
+  std::atomic<unsigned int> readyThreads(0);
+  std::atomic<bool> started(false);
+  std::vector<double> threadSeconds(threadCount);
+  std::vector<unsigned long long> allocations(threadCount);
+  std::vector<std::thread> threads;
+  for (unsigned int threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+  {
+    threads.emplace_back([&, threadIndex]() {
+      // Warms the call site, the buffers and the caches up
+      for (unsigned int iteration = 0; iteration < iterations / 10 + 1; ++iteration)
+        macro.call(iteration);
+      ++readyThreads;
+      while (!started)
+        std::this_thread::yield();
+      const unsigned long long allocationsBefore = GetThreadAllocations();
+      const auto start = std::chrono::steady_clock::now();
+      for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+        macro.call(iteration);
+      threadSeconds[threadIndex] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      allocations[threadIndex] = GetThreadAllocations() - allocationsBefore;
+    });
+  }
+  while (readyThreads < threadCount)
+    std::this_thread::yield();
+  const auto start = std::chrono::steady_clock::now();
+  started = true;
+  for (auto& thread : threads)
+    thread.join();
+  const double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  // Writes the traces left in the caches and the buffers, and makes sure the drop counter is up to date
+  TraceDebug::Finalize();
+  DISPLAY_DEBUG_ACTIVE_TRACE;
+  SET_TRACE_ENABLED(macro.callSiteName, true);
+
+  BenchmarkResult result;
+  result.macro = &macro;
+  result.state = state;
+  result.cacheDeepness = cacheDeepness;
+  result.threadCount = threadCount;
+  result.iterations = iterations;
+  double seconds = 0.;
+  unsigned long long allocationCount = 0;
+  for (unsigned int threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+  {
+    seconds += threadSeconds[threadIndex];
+    allocationCount += allocations[threadIndex];
+  }
+  const double operations = static_cast<double>(threadCount) * iterations;
+  result.nanosecondsPerOperation = seconds * 1e9 / operations;
+  result.operationsPerSecond = operations / elapsedSeconds;
+  result.allocationsPerOperation = static_cast<double>(allocationCount) / operations;
+  result.droppedTraces = TraceDebug::GetDroppedTraceCount() - droppedBefore;
+  return result;
+}
+
+std::string GetOptions()
+{
+  std::string options;
+  auto add = [&options](const char* option) { options += std::string(options.empty() ? "\"" : ", \"") + option + "\""; };
+  // Options as they are in effect, e.g. TRACE_DEBUG_TSC_CLOCK when TRACE_DEBUG_USE_TSC could be honored
+#ifdef ENABLE_THREAD_SAFE
+  add("ENABLE_THREAD_SAFE");
+#endif
+#ifdef TRACE_DEBUG_LOCK_FREE
+  add("TRACE_DEBUG_LOCK_FREE");
+#endif
+#ifdef TRACE_DEBUG_USE_GLOBAL_MUTEX
+  add("TRACE_DEBUG_USE_GLOBAL_MUTEX");
+#endif
+#ifdef TRACE_DEBUG_ASYNC_WRITER
+  add("TRACE_DEBUG_ASYNC_WRITER");
+#endif
+#ifdef WRITE_OUTPUT_TO_FILE
+  add("WRITE_OUTPUT_TO_FILE");
+#endif
+#ifdef TRACE_DEBUG_BINARY_OUTPUT
+  add("TRACE_DEBUG_BINARY_OUTPUT");
+#endif
+#ifdef TRACE_DEBUG_CHROME_TRACE
+  add("TRACE_DEBUG_CHROME_TRACE");
+#endif
+#ifdef TRACE_DEBUG_MAPPED_OUTPUT
+  add("TRACE_DEBUG_MAPPED_OUTPUT");
+#endif
+#ifdef TRACE_DEBUG_ROTATE_OUTPUT
+  add("TRACE_DEBUG_ROTATE_OUTPUT");
+#endif
+#ifdef TRACE_DEBUG_COMPRESS_OUTPUT
+  add("TRACE_DEBUG_COMPRESS_OUTPUT");
+#endif
+#ifdef USE_QT_DEBUG
+  add("USE_QT_DEBUG");
+#endif
+#ifdef UNIT_TRACE_DEBUG_NANO
+  add("UNIT_TRACE_DEBUG_NANO");
+#endif
+#ifdef TRACE_DEBUG_DEFERRED_FORMAT
+  add("TRACE_DEBUG_DEFERRED_FORMAT");
+#endif
+#ifdef TRACE_DEBUG_AGGREGATE_STATISTICS
+  add("TRACE_DEBUG_AGGREGATE_STATISTICS");
+#endif
+#ifdef TRACE_DEBUG_TSC_CLOCK
+  add("TRACE_DEBUG_TSC_CLOCK");
+#endif
+#ifdef TRACE_DEBUG_OVERHEAD_COMPENSATION
+  add("TRACE_DEBUG_OVERHEAD_COMPENSATION");
+#endif
+#ifdef TRACE_DEBUG_CALL_TREE
+  add("TRACE_DEBUG_CALL_TREE");
+#endif
+#ifdef TRACE_DEBUG_PERF_COUNTERS
+  add("TRACE_DEBUG_PERF_COUNTERS");
+#endif
+#ifdef TRACE_DEBUG_COUNT_ALLOCATIONS
+  add("TRACE_DEBUG_COUNT_ALLOCATIONS");
+#endif
+#ifdef TRACE_DEBUG_FLIGHT_RECORDER
+  add("TRACE_DEBUG_FLIGHT_RECORDER");
+#endif
+#ifdef TRACE_DEBUG_SIGNAL_DUMP
+  add("TRACE_DEBUG_SIGNAL_DUMP");
+#endif
+#ifdef TRACE_DEBUG_TIME_SERIES
+  add("TRACE_DEBUG_TIME_SERIES");
+#endif
+  return "[" + options + "]";
+}
+
+std::string EscapeJson(const std::string& text)
+{
+  std::string escaped;
+  for (char character : text)
+  {
+    if (character == '"' || character == '\\')
+      escaped += '\\';
+    escaped += character;
+  }
+  return escaped;
+}
+
+void WriteResults(std::ostream& output, const std::vector<BenchmarkResult>& results, unsigned int maxThreads)
+{
+#ifdef __VERSION__
+  const char* compiler = __VERSION__;
+#elif defined(_MSC_FULL_VER)
+  const std::string compilerVersion = "MSVC " + std::to_string(_MSC_FULL_VER);
+  const char* compiler = compilerVersion.c_str();
+#else
+  const char* compiler = "unknown";
+#endif
+  output << "{\n"
+         << "  \"configuration\": {\n"
+         << "    \"options\": " << GetOptions() << ",\n"
+         << "    \"compiler\": \"" << EscapeJson(compiler) << "\",\n"
+         << "    \"hardwareConcurrency\": " << std::thread::hardware_concurrency() << ",\n"
+         << "    \"maxThreads\": " << maxThreads << ",\n"
+         << "    \"displayStartTracePerformance\": false\n"
+         << "  },\n"
+         << "  \"results\": [";
+  for (size_t index = 0; index < results.size(); ++index)
+  {
+    const BenchmarkResult& result = results[index];
+    output << (index == 0 ? "\n" : ",\n")
+           << "    {\"macro\": \"" << result.macro->name << "\", \"operation\": \"" << EscapeJson(result.macro->operation) << "\""
+           << ", \"traces\": \"" << GetTraceStateName(result.state) << "\""
+           << ", \"cacheDeepness\": " << result.cacheDeepness
+           << ", \"threads\": " << result.threadCount
+           << ", \"iterationsPerThread\": " << result.iterations
+           << ", \"nsPerOp\": " << result.nanosecondsPerOperation
+           << ", \"opsPerSecond\": " << static_cast<unsigned long long>(result.operationsPerSecond)
+           << ", \"allocationsPerOp\": " << result.allocationsPerOperation
+           << ", \"droppedTraces\": " << result.droppedTraces << "}";
+  }
+  output << "\n  ]\n}" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned int maxThreads = argc > 1 ? std::atoi(argv[1]) : std::max(4u, std::thread::hardware_concurrency());
+  unsigned int iterations = argc > 2 ? std::atoi(argv[2]) : 20000;
+  const char* resultFileName = argc > 3 ? argv[3] : nullptr;
+
+  DISPLAY_START_TRACE_PERFORMANCE(false);
+  std::vector<BenchmarkResult> results;
+  for (const BenchmarkMacro& macro : benchmarkMacros)
+  {
+    for (TraceState state : {TraceState::Active, TraceState::Deactivated, TraceState::Disabled})
+    {
+      // Without cache each measure is output at once, with it measures are output by batches
+      for (unsigned int cacheDeepness : {0u, 1000u})
+      {
+        for (unsigned int threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+        {
+          results.push_back(Measure(macro, state, cacheDeepness, threadCount, iterations));
+          if (resultFileName != nullptr)
+          {
+            const BenchmarkResult& result = results.back();
+            std::cerr << macro.name << ", " << GetTraceStateName(state) << ", cache " << cacheDeepness << ", " << threadCount
+                      << " threads: " << result.nanosecondsPerOperation << " ns/op, " << result.allocationsPerOperation
+                      << " allocations/op" << std::endl;
+          }
+        }
+      }
+    }
+  }
+
+  if (resultFileName != nullptr)
+  {
+    std::ofstream resultFile(resultFileName);
+    WriteResults(resultFile, results, maxThreads);
+  }
+  else
+  {
+    WriteResults(std::cerr, results, maxThreads);
+  }
+  return 0;
+}
+#else
+int main()
+{
+  std::cerr << "ENABLE_TRACE_DEBUG is not defined" << std::endl;
+  return 0;
+}
+#endif
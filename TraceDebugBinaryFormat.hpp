@@ -0,0 +1,87 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2BlackCoffees 2016
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __TRACE_DEBUG_BINARY_FORMAT_HPP
+#define __TRACE_DEBUG_BINARY_FORMAT_HPP
+
+#include <cstdint>
+
+// Layout of the files written when TRACE_DEBUG_BINARY_OUTPUT is defined, shared by TraceDebug and TraceDebugDecoder.
+// A file starts with a TraceDebugBinaryHeader followed by records. Each record is a TraceDebugBinaryRecord followed by
+// payloadSize bytes. Call sites, threads and labels are written once in a definition record and afterwards referenced by
+// their id. All integers are written in the byte order of the writing machine (see byteOrderMark).
+
+// Kind of a record
+enum TraceDebugBinaryKind : uint8_t {
+  // payload: int32 line number, then file name, function name and label (unique key or expression), each ended by '\0'
+  TRACE_DEBUG_BINARY_CALL_SITE = 0,
+  // payload: thread id as displayed in the text traces
+  TRACE_DEBUG_BINARY_THREAD = 1,
+  // callSiteId is the label id, payload: the label of an ADD_TRACE_PERFORMANCE
+  TRACE_DEBUG_BINARY_LABEL = 2,
+  // payload: free text (no call site)
+  TRACE_DEBUG_BINARY_TEXT = 3,
+  // START_TRACE_PERFORMANCE constructed, no payload
+  TRACE_DEBUG_BINARY_START_MEASURE = 4,
+  // START_TRACE_PERFORMANCE results, payload: checkpointCount TraceDebugBinaryCheckpoint
+  TRACE_DEBUG_BINARY_END_MEASURE = 5,
+  // DISPLAY_DEBUG_VALUE before evaluating the value, no payload
+  TRACE_DEBUG_BINARY_PROCESSING_VALUE = 6,
+  // DISPLAY_DEBUG_VALUE result, payload: the value
+  TRACE_DEBUG_BINARY_VALUE = 7,
+  // DISPLAY_IMMEDIATE_DEBUG_VALUE, payload: the value
+  TRACE_DEBUG_BINARY_IMMEDIATE_VALUE = 8,
+  // DISPLAY_DEBUG_MESSAGE, payload: the message
+  TRACE_DEBUG_BINARY_MESSAGE = 9
+};
+
+// Flags of the header
+enum TraceDebugBinaryFlags : uint32_t {
+  // Durations are displayed in ns instead of ms (UNIT_TRACE_DEBUG_NANO)
+  TRACE_DEBUG_BINARY_UNIT_NANO = 1,
+  // Thread ids are displayed (ENABLE_THREAD_SAFE)
+  TRACE_DEBUG_BINARY_THREAD_ID = 2
+};
+
+struct TraceDebugBinaryHeader {
+  char magic[8];            // "TRCDBG\0\0"
+  uint32_t byteOrderMark;   // 0x01020304
+  uint32_t version;         // 1
+  uint32_t flags;           // TraceDebugBinaryFlags
+  uint32_t reserved;
+};
+
+struct TraceDebugBinaryRecord {
+  uint32_t callSiteId;      // or label id / free for TRACE_DEBUG_BINARY_THREAD and TRACE_DEBUG_BINARY_TEXT
+  uint32_t threadIndex;
+  int64_t  time;            // ns since epoch
+  uint8_t  kind;            // TraceDebugBinaryKind
+  uint8_t  deepness;        // hierarchy deepness, capped to 255
+  uint16_t checkpointCount; // TRACE_DEBUG_BINARY_END_MEASURE only
+  uint32_t payloadSize;
+};
+
+struct TraceDebugBinaryCheckpoint {
+  uint32_t labelId;
+  uint32_t reserved;
+  int64_t  ticks;           // ns since epoch, same time base as TraceDebugBinaryRecord::time
+};
+
+static_assert(sizeof(TraceDebugBinaryHeader) == 24, "Unexpected TraceDebugBinaryHeader size");
+static_assert(sizeof(TraceDebugBinaryRecord) == 24, "Unexpected TraceDebugBinaryRecord size");
+static_assert(sizeof(TraceDebugBinaryCheckpoint) == 16, "Unexpected TraceDebugBinaryCheckpoint size");
+
+#define TRACE_DEBUG_BINARY_MAGIC "TRCDBG\0"
+#define TRACE_DEBUG_BINARY_BYTE_ORDER_MARK 0x01020304u
+#define TRACE_DEBUG_BINARY_VERSION 1u
+
+#endif
@@ -0,0 +1,290 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2BlackCoffees 2016
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Converts the files written with TRACE_DEBUG_BINARY_OUTPUT back to the text traces or to csv:
+//
+// g++ -std=c++11 -O2 -o TraceDebugDecoder TraceDebugDecoder.cpp
+//
+// ./TraceDebugDecoder [--csv] TraceDebug-<pid>.bin > TraceDebug.log
+
+#include "TraceDebugBinaryFormat.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+struct CallSite {
+  int lineNumber = 0;
+  std::string fileName;
+  std::string functionName;
+  std::string label;
+};
+
+class TraceDebugDecoder {
+  public:
+    TraceDebugDecoder(std::istream& input, std::ostream& output, bool csv): input(input), output(output), csv(csv) {}
+
+    bool Decode()
+    {
+      TraceDebugBinaryHeader header;
+      if (!Read(&header, sizeof(header)) || std::memcmp(header.magic, TRACE_DEBUG_BINARY_MAGIC, sizeof(header.magic)) != 0)
+      {
+        std::cerr << "Not a TraceDebug binary file" << std::endl;
+        return false;
+      }
+      if (header.byteOrderMark != TRACE_DEBUG_BINARY_BYTE_ORDER_MARK || header.version != TRACE_DEBUG_BINARY_VERSION)
+      {
+        std::cerr << "Unsupported byte order or version " << header.version << std::endl;
+        return false;
+      }
+      unitNano = (header.flags & TRACE_DEBUG_BINARY_UNIT_NANO) != 0;
+      displayThreadId = (header.flags & TRACE_DEBUG_BINARY_THREAD_ID) != 0;
+      if (csv)
+      {
+        output << "time_ns,thread,deepness,event,file,line,function,label,value,duration_ns\n";
+      }
+
+      TraceDebugBinaryRecord record;
+      std::string payload;
+      while (Read(&record, sizeof(record)))
+      {
+        payload.resize(record.payloadSize);
+        if (record.payloadSize > 0 && !Read(&payload[0], payload.size()))
+        {
+          std::cerr << "Truncated record" << std::endl;
+          return false;
+        }
+        DecodeRecord(record, payload);
+      }
+      return true;
+    }
+
+  private:
+    std::istream& input;
+    std::ostream& output;
+    bool csv;
+    bool unitNano = false;
+    bool displayThreadId = true;
+    std::map<uint32_t, CallSite> callSites;
+    std::map<uint32_t, std::string> threads;
+    std::map<uint32_t, std::string> labels;
+
+    bool Read(void* data, size_t size)
+    {
+      input.read(static_cast<char*>(data), size);
+      return static_cast<size_t>(input.gcount()) == size;
+    }
+
+    // Same formatting as TraceDebug::FormatTimeAndThreadId and TraceDebug::GetPerformanceResults
+    std::string FormatDuration(int64_t nanoSeconds) const
+    {
+      return std::to_string(unitNano ? static_cast<double>(nanoSeconds) : nanoSeconds / 1e6) + (unitNano ? "ns" : "ms");
+    }
+
+    static std::string GetSpaces(unsigned int deepness)
+    {
+      if (deepness > 1) {
+        return std::string(2 * (deepness - 1), ' ');
+      }
+      return "";
+    }
+
+    static std::string CsvField(const std::string& field)
+    {
+      if (field.find_first_of(",\"\n") == std::string::npos)
+        return field;
+      std::string quoted = "\"";
+      for (char character : field)
+      {
+        if (character == '"')
+          quoted += '"';
+        quoted += character;
+      }
+      return quoted + "\"";
+    }
+
+    static const char* GetEventName(uint8_t kind)
+    {
+      switch (kind)
+      {
+        case TRACE_DEBUG_BINARY_TEXT:             return "text";
+        case TRACE_DEBUG_BINARY_START_MEASURE:    return "start_measure";
+        case TRACE_DEBUG_BINARY_END_MEASURE:      return "end_measure";
+        case TRACE_DEBUG_BINARY_PROCESSING_VALUE: return "processing_value";
+        case TRACE_DEBUG_BINARY_VALUE:            return "value";
+        case TRACE_DEBUG_BINARY_IMMEDIATE_VALUE:  return "immediate_value";
+        case TRACE_DEBUG_BINARY_MESSAGE:          return "message";
+        default:                                  return "unknown";
+      }
+    }
+
+    void DecodeRecord(const TraceDebugBinaryRecord& record, const std::string& payload)
+    {
+      switch (record.kind)
+      {
+        case TRACE_DEBUG_BINARY_CALL_SITE:
+        {
+          CallSite& callSite = callSites[record.callSiteId];
+          int32_t lineNumber = 0;
+          std::memcpy(&lineNumber, payload.data(), std::min(sizeof(lineNumber), payload.size()));
+          callSite.lineNumber = lineNumber;
+          // Three strings ended by '\0' follow the line number
+          size_t begin = sizeof(lineNumber);
+          std::string* fields[] = {&callSite.fileName, &callSite.functionName, &callSite.label};
+          for (std::string* field : fields)
+          {
+            size_t end = std::min(payload.find('\0', begin), payload.size());
+            if (begin < end)
+              field->assign(payload, begin, end - begin);
+            begin = end + 1;
+          }
+          return;
+        }
+        case TRACE_DEBUG_BINARY_THREAD:
+          threads[record.threadIndex] = payload;
+          return;
+        case TRACE_DEBUG_BINARY_LABEL:
+          labels[record.callSiteId] = payload;
+          return;
+        default:
+          break;
+      }
+
+      std::vector<TraceDebugBinaryCheckpoint> checkpoints(record.checkpointCount);
+      if (record.kind == TRACE_DEBUG_BINARY_END_MEASURE && !checkpoints.empty())
+      {
+        std::memcpy(checkpoints.data(), payload.data(),
+                    std::min(payload.size(), checkpoints.size() * sizeof(TraceDebugBinaryCheckpoint)));
+      }
+      if (csv)
+        WriteCsv(record, payload, checkpoints);
+      else
+        WriteText(record, payload, checkpoints);
+    }
+
+    void WriteText(const TraceDebugBinaryRecord& record, const std::string& payload,
+                   const std::vector<TraceDebugBinaryCheckpoint>& checkpoints)
+    {
+      std::string line = GetSpaces(record.deepness);
+      if (record.kind == TRACE_DEBUG_BINARY_TEXT)
+      {
+        output << line << payload << '\n';
+        return;
+      }
+      const CallSite& callSite = callSites[record.callSiteId];
+      line += FormatDuration(record.time);
+      if (displayThreadId)
+        line += ":" + threads[record.threadIndex];
+      line += ":";
+      const std::string location = callSite.fileName + ":" + std::to_string(callSite.lineNumber) + " (" + callSite.functionName + ")";
+      switch (record.kind)
+      {
+        case TRACE_DEBUG_BINARY_START_MEASURE:
+          line += location + " [" + callSite.label + "]  Start measure";
+          break;
+        case TRACE_DEBUG_BINARY_END_MEASURE:
+          line += location + " [" + callSite.label + "]";
+          for (size_t index = 0; index + 1 < checkpoints.size(); ++index)
+          {
+            line += ", <" + labels[checkpoints[index + 1].labelId] + "> - <" + labels[checkpoints[index].labelId] + "> = "
+                    + FormatDuration(checkpoints[index + 1].ticks - checkpoints[index].ticks);
+          }
+          if (checkpoints.size() > 2)
+          {
+            line += ", Full time: " + FormatDuration(checkpoints.back().ticks - checkpoints.front().ticks);
+          }
+          break;
+        case TRACE_DEBUG_BINARY_PROCESSING_VALUE:
+          line += "Processing " + callSite.label + "  From " + location;
+          break;
+        case TRACE_DEBUG_BINARY_VALUE:
+          line += "->" + location + "  " + callSite.label + " = " + payload;
+          break;
+        case TRACE_DEBUG_BINARY_IMMEDIATE_VALUE:
+          line += location + "  " + callSite.label + " = " + payload;
+          break;
+        default:
+          line += location + "  " + payload;
+          break;
+      }
+      output << line << '\n';
+    }
+
+    // One row per trace, one row per measured segment for the results of START_TRACE_PERFORMANCE
+    void WriteCsv(const TraceDebugBinaryRecord& record, const std::string& payload,
+                  const std::vector<TraceDebugBinaryCheckpoint>& checkpoints)
+    {
+      const CallSite& callSite = callSites[record.callSiteId];
+      const bool hasCallSite = record.kind != TRACE_DEBUG_BINARY_TEXT;
+      const std::string prefix = std::to_string(record.time) + "," + CsvField(threads[record.threadIndex]) + ","
+                                 + std::to_string(record.deepness) + "," + GetEventName(record.kind) + ","
+                                 + (hasCallSite ? CsvField(callSite.fileName) + "," + std::to_string(callSite.lineNumber) + ","
+                                                  + CsvField(callSite.functionName) + "," + CsvField(callSite.label)
+                                                : std::string(",,,"));
+      if (record.kind != TRACE_DEBUG_BINARY_END_MEASURE)
+      {
+        output << prefix << "," << CsvField(payload) << ",\n";
+        return;
+      }
+      for (size_t index = 0; index + 1 < checkpoints.size(); ++index)
+      {
+        output << prefix << "," << CsvField("<" + labels[checkpoints[index + 1].labelId] + "> - <"
+                                            + labels[checkpoints[index].labelId] + ">")
+               << "," << checkpoints[index + 1].ticks - checkpoints[index].ticks << "\n";
+      }
+      if (checkpoints.size() > 2)
+      {
+        output << prefix << ",Full time," << checkpoints.back().ticks - checkpoints.front().ticks << "\n";
+      }
+    }
+};
+
+int main(int argc, char** argv)
+{
+  bool csv = false;
+  const char* fileName = nullptr;
+  for (int index = 1; index < argc; ++index)
+  {
+    if (std::strcmp(argv[index], "--csv") == 0)
+      csv = true;
+    else
+      fileName = argv[index];
+  }
+  if (fileName == nullptr)
+  {
+    std::cerr << "Usage: " << argv[0] << " [--csv] TraceDebug-<pid>.bin" << std::endl;
+    return 1;
+  }
+  std::ifstream input(fileName, std::ifstream::in | std::ifstream::binary);
+  if (!input)
+  {
+    std::cerr << "Cannot open " << fileName << std::endl;
+    return 1;
+  }
+  TraceDebugDecoder decoder(input, std::cout, csv);
+  return decoder.Decode() ? 0 : 1;
+}
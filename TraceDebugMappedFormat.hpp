@@ -0,0 +1,42 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2BlackCoffees 2016
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __TRACE_DEBUG_MAPPED_FORMAT_HPP
+#define __TRACE_DEBUG_MAPPED_FORMAT_HPP
+
+#include <cstdint>
+
+// Layout of the files written when TRACE_DEBUG_MAPPED_OUTPUT is defined, shared by TraceDebug and TraceDebugRecover.
+// A file starts with a TraceDebugMappedHeader followed by dataSize bytes used as a circular buffer of text traces, one
+// per line. Bytes are written at cursor, which goes back to 0 at the end of the buffer. Once the buffer wrapped, the
+// oldest bytes are those following cursor: the first line found there is usually incomplete.
+// All integers are written in the byte order of the writing machine (see byteOrderMark).
+
+struct TraceDebugMappedHeader {
+  char magic[8];            // "TRCDBGM\0"
+  uint32_t byteOrderMark;   // 0x01020304
+  uint32_t version;         // 1
+  uint64_t dataSize;        // size of the circular buffer following the header
+  uint64_t cursor;          // offset in the circular buffer of the next byte written, updated after each write
+  uint64_t wrapCount;       // number of times cursor went back to 0
+  uint32_t closed;          // 1 when the file was closed by TraceDebug::Finalize, 0 if the program crashed
+  uint32_t reserved;
+  uint64_t reserved2[2];
+};
+
+static_assert(sizeof(TraceDebugMappedHeader) == 64, "Unexpected TraceDebugMappedHeader size");
+
+#define TRACE_DEBUG_MAPPED_MAGIC "TRCDBGM"
+#define TRACE_DEBUG_MAPPED_BYTE_ORDER_MARK 0x01020304u
+#define TRACE_DEBUG_MAPPED_VERSION 1u
+
+#endif
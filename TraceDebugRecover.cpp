@@ -0,0 +1,150 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2BlackCoffees 2016
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Extracts the traces of the files written with TRACE_DEBUG_MAPPED_OUTPUT, oldest first, including the files left by a
+// program that crashed:
+//
+// g++ -std=c++11 -O2 -o TraceDebugRecover TraceDebugRecover.cpp
+//
+// ./TraceDebugRecover [-n lastTraceCount] TraceDebug-<pid>.mmap > TraceDebug.log
+
+#include "TraceDebugMappedFormat.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class TraceDebugRecover {
+  public:
+    TraceDebugRecover(std::istream& input, std::ostream& output, size_t lastTraceCount):
+      input(input), output(output), lastTraceCount(lastTraceCount) {}
+
+    bool Recover()
+    {
+      TraceDebugMappedHeader header;
+      if (!Read(&header, sizeof(header)) || std::memcmp(header.magic, TRACE_DEBUG_MAPPED_MAGIC, sizeof(header.magic)) != 0)
+      {
+        std::cerr << "Not a TraceDebug mapped file" << std::endl;
+        return false;
+      }
+      if (header.byteOrderMark != TRACE_DEBUG_MAPPED_BYTE_ORDER_MARK || header.version != TRACE_DEBUG_MAPPED_VERSION)
+      {
+        std::cerr << "Unsupported byte order or version " << header.version << std::endl;
+        return false;
+      }
+      if (header.cursor > header.dataSize)
+      {
+        std::cerr << "Corrupted header: cursor " << header.cursor << " beyond " << header.dataSize << std::endl;
+        return false;
+      }
+      std::string data(static_cast<size_t>(header.dataSize), '\0');
+      if (!data.empty() && !Read(&data[0], data.size()))
+      {
+        std::cerr << "Truncated file" << std::endl;
+        return false;
+      }
+      std::cerr << (header.closed ? "Closed by TraceDebug::Finalize" : "Not closed: the program crashed or is running")
+                << ", buffer of " << header.dataSize << " bytes written " << header.wrapCount << " time(s)" << std::endl;
+
+      // Oldest bytes first
+      const size_t cursor = static_cast<size_t>(header.cursor);
+      std::string traces;
+      if (header.wrapCount > 0)
+      {
+        traces = data.substr(cursor) + data.substr(0, cursor);
+        // The first line was partly overwritten
+        const size_t firstLineEnd = traces.find('\n');
+        traces.erase(0, firstLineEnd == std::string::npos ? traces.size() : firstLineEnd + 1);
+      }
+      else
+      {
+        traces = data.substr(0, cursor);
+      }
+      WriteLastTraces(traces);
+      return true;
+    }
+
+  private:
+    std::istream& input;
+    std::ostream& output;
+    // 0 for all the traces
+    size_t lastTraceCount;
+
+    bool Read(void* bytes, size_t size)
+    {
+      input.read(static_cast<char*>(bytes), size);
+      return static_cast<size_t>(input.gcount()) == size;
+    }
+
+    void WriteLastTraces(const std::string& traces)
+    {
+      size_t begin = 0;
+      if (lastTraceCount > 0)
+      {
+        // Search backward the beginning of the last lines
+        size_t count = 0;
+        size_t position = traces.size();
+        if (position > 0 && traces[position - 1] == '\n')
+          --position;
+        while (position > 0 && count < lastTraceCount)
+        {
+          const size_t previousLineEnd = traces.rfind('\n', position - 1);
+          begin = previousLineEnd == std::string::npos ? 0 : previousLineEnd + 1;
+          position = previousLineEnd == std::string::npos ? 0 : previousLineEnd;
+          ++count;
+        }
+      }
+      output.write(traces.data() + begin, static_cast<std::streamsize>(traces.size() - begin));
+      if (!traces.empty() && traces.back() != '\n')
+        output << '\n';
+    }
+};
+
+int main(int argc, char** argv)
+{
+  size_t lastTraceCount = 0;
+  const char* fileName = nullptr;
+  for (int index = 1; index < argc; ++index)
+  {
+    if (std::strcmp(argv[index], "-n") == 0 && index + 1 < argc)
+      lastTraceCount = static_cast<size_t>(std::strtoull(argv[++index], nullptr, 10));
+    else
+      fileName = argv[index];
+  }
+  if (fileName == nullptr)
+  {
+    std::cerr << "Usage: " << argv[0] << " [-n lastTraceCount] TraceDebug-<pid>.mmap" << std::endl;
+    return 1;
+  }
+  std::ifstream input(fileName, std::ifstream::in | std::ifstream::binary);
+  if (!input)
+  {
+    std::cerr << "Cannot open " << fileName << std::endl;
+    return 1;
+  }
+  TraceDebugRecover recover(input, std::cout, lastTraceCount);
+  return recover.Recover() ? 0 : 1;
+}